@@ -311,6 +311,14 @@ already exist. (default: 0)
 If set to 1, the patterns hit can be retrieved from the
 C<Mail::SpamAssassin::PerMsgStatus> object.  Used for debugging.
 
+=item profile_rules
+
+If set to 1, the time taken by each rule, the number of times it was run
+and the number of times it hit are recorded, across all messages checked.
+See C<save_rule_profile()> and C<rule_profile_report()>.  Costs a little
+time per rule, so leave it off unless you are looking for slow rules.
+(default: 0)
+
 =item home_dir_for_helpers
 
 If set, the B<HOME> environment variable will be set to this value
@@ -548,6 +556,7 @@ sub parse {
   my $msg = Mail::SpamAssassin::Message->new({
     message=>$message, parsenow=>$parsenow,
     normalize=>$self->{conf}->{normalize_charset},
+    decode_budget=>$self->{conf}->{attachment_decode_budget},
     master_deadline=>$master_deadline, suppl_attrib=>$suppl_attrib });
 
   # bug 5069: The goal here is to get rendering plugins to do things
@@ -698,6 +707,13 @@ expire but report back whether or not it should occur (optional, default 0).
 If doing a learn operation, and the message has already been learned as
 the opposite type, don't re-learn the message.
 
+=item defer_learning
+
+While checking a message, don't write to the learner's databases (Bayes
+token atime updates and auto-learning), but leave that for when the caller
+calls C<$status-E<gt>learn_deferred()>, typically after the result has been
+passed on (optional, default 0).
+
 =back
 
 =cut
@@ -717,6 +733,7 @@ sub init_learner {
     'wait_for_lock'			=> 'learn_wait_for_lock',
     'opportunistic_expire_check_only'	=> 'opportunistic_expire_check_only',
     'no_relearn'			=> 'learn_no_relearn',
+    'defer_learning'			=> 'learn_defer',
   );
 
   my %ret;
@@ -1515,6 +1532,103 @@ sub lint_rules {
 
 ###########################################################################
 
+=item $f->save_rule_profile ($filename)
+
+With the C<profile_rules> option, add the rule timings recorded so far to
+the totals kept in C<$filename>, and start recording afresh.  Several
+processes, such as the children of C<spamd>, may share one file.  Returns 1
+on success, or 0 if the file could not be updated.
+
+=cut
+
+sub save_rule_profile {
+  my ($self, $filename) = @_;
+
+  my $profile = $self->{rule_profile};
+  return 1 unless $profile && %{$profile};
+
+  $filename = Mail::SpamAssassin::Util::untaint_file_path($filename);
+  if (!$self->{locker}->safe_lock($filename, 30)) {
+    warn "profile: cannot lock $filename, rule profile not saved\n";
+    return 0;
+  }
+
+  my $totals = $self->read_rule_profile($filename);
+  while (my ($rule, $p) = each %{$profile}) {
+    my $t = $totals->{$rule} ||= [0,0,0];
+    $t->[$_] += $p->[$_]  for 0..2;
+  }
+
+  my $ok = 0;
+  if (open(my $fh, '>', $filename)) {
+    print $fh "# rule runs seconds hits\n";
+    foreach my $rule (sort keys %{$totals}) {
+      printf $fh "%s %d %.6f %d\n", $rule, @{$totals->{$rule}};
+    }
+    $ok = close($fh);
+  }
+  warn "profile: cannot write $filename: $!\n"  if !$ok;
+
+  $self->{locker}->safe_unlock($filename);
+  $self->{rule_profile} = {}  if $ok;
+  return $ok ? 1 : 0;
+}
+
+# read a file written by save_rule_profile(); a missing file is empty
+sub read_rule_profile {
+  my ($self, $filename) = @_;
+  my %totals;
+
+  open(my $fh, '<', $filename) or return \%totals;
+  while (<$fh>) {
+    next if /^#/;
+    my ($rule, @counts) = split;
+    next unless defined $rule && @counts == 3;
+    $totals{$rule} = \@counts;
+  }
+  close $fh;
+  return \%totals;
+}
+
+=item $text = $f->rule_profile_report ( [ $filename ] )
+
+Return a report of the rule timings recorded with the C<profile_rules>
+option, slowest rules first: for each rule, the total time taken, the
+number of times run, the average time per run, and the number and
+proportion of hits.  If C<$filename> is given, the totals saved in that
+file by C<save_rule_profile()> are reported instead.
+
+=cut
+
+sub rule_profile_report {
+  my ($self, $filename) = @_;
+
+  my $profile = defined $filename ? $self->read_rule_profile($filename)
+                                  : ($self->{rule_profile} || {});
+
+  my $total = 0;
+  $total += $_->[1]  for values %{$profile};
+
+  my @str = (sprintf("%10s %6s %9s %9s %8s %6s  %s\n",
+                     'total ms', '%time', 'runs', 'us/run', 'hits', '%hit',
+                     'rule'));
+  foreach my $rule (sort { $profile->{$b}->[1] <=> $profile->{$a}->[1]
+                           || $a cmp $b } keys %{$profile})
+  {
+    my ($runs, $secs, $hits) = @{$profile->{$rule}};
+    push @str, sprintf("%10.1f %6.2f %9d %9.1f %8d %6.2f  %s\n",
+                       $secs*1000, $total ? 100*$secs/$total : 0, $runs,
+                       $runs ? 1e6*$secs/$runs : 0,
+                       $hits, $runs ? 100*$hits/$runs : 0, $rule);
+  }
+  push @str, sprintf("%10.1f %6.2f %9s %9s %8s %6s  %s\n",
+                     $total*1000, 100, '', '', '', '',
+                     scalar(keys %{$profile}).' rules');
+  return join('', @str);
+}
+
+###########################################################################
+
 =item $f->finish()
 
 Destroy this object, so that it will be garbage-collected once it
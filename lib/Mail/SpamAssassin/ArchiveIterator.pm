@@ -24,11 +24,13 @@ use warnings;
 use bytes;
 use re 'taint';
 
-use Errno qw(ENOENT EACCES EBADF);
+use Errno qw(ENOENT EACCES EBADF EINTR);
+use POSIX ();
 use Mail::SpamAssassin::Util;
 use Mail::SpamAssassin::Constants qw(:sa);
 use Mail::SpamAssassin::Logger;
 use Mail::SpamAssassin::AICache;
+use Mail::SpamAssassin::SubProcBackChannel;
 
 # 256 KiB is a big email, unless stated otherwise
 use constant BIG_BYTES => 256*1024;
@@ -151,6 +153,23 @@ Set to the path of a directory where you wish to store cached information for
 C<opt_cache>, if you don't want to mix them with the input files (as is the
 default).  The directory must be both readable and writable.
 
+=item opt_j
+
+Number of worker processes to run the C<wanted_sub> in.  The default, 0 or
+1, processes every message in the calling process.  With a larger value,
+run() forks that many workers after the targets have been scanned, and
+hands them one message at a time as they become idle, so a single large
+mailbox is shared out between all of them rather than left to one.  The
+C<result_sub> is still called in the calling process, which means the
+result returned by C<wanted_sub> must be a plain scalar, and any state the
+C<wanted_sub> keeps in the worker is not seen by the caller.
+
+=item opt_ordered
+
+Only used with I<opt_j>.  Set to 1 to have C<result_sub> called in the
+same order the messages would have been processed without workers.  The
+default, 0, calls it as soon as each result arrives.
+
 =item wanted_sub
 
 Reference to a subroutine which will process message data.  Usually
@@ -172,6 +191,13 @@ from wanted_sub), and received date (scalar).
 Note that if C<opt_want_date> is set to 0, the received date scalar will be
 undefined.
 
+=item worker_exit_sub
+
+Only used with I<opt_j>.  Reference to a subroutine which each worker
+process calls once it has no more messages to process, just before it
+exits; use it to close databases or other resources the C<wanted_sub> has
+opened in that worker.
+
 =item scan_progress_sub
 
 Reference to a subroutine which will be called intermittently during
@@ -321,6 +347,10 @@ sub run {
 sub _run {
   my ($self, $messages) = @_;
 
+  if ($self->{opt_j} && $self->{opt_j} > 1 && @{$messages} > 1) {
+    return $self->_run_parallel($messages);
+  }
+
   while (my $message = shift @{$messages}) {
     my($class, undef, $date, undef, $result) = $self->_run_message($message);
     &{$self->{result_sub}}($class, $result, $date) if $result;
@@ -330,6 +360,168 @@ sub _run {
 
 ############################################################################
 
+## parallel mode: each worker asks for another message when it is done
+## with the previous one, so the load evens out by itself.  The parent
+## sends a message index, the worker (which has its own copy of the
+## index list since the fork) answers with a header line and a payload:
+##   R <index> <access_problem> <length>\n<class, date and result>
+##   E <index> <access_problem> <length>\n<error message>
+
+sub _run_parallel {
+  my ($self, $messages) = @_;
+
+  my $njobs = $self->{opt_j};
+  $njobs = scalar @{$messages}  if $njobs > @{$messages};
+  dbg("archive-iterator: running %d messages in %d worker processes",
+      scalar @{$messages}, $njobs);
+
+  # a worker that went away is noticed when reading its answer
+  local $SIG{PIPE} = 'IGNORE';
+
+  my $backchannel = Mail::SpamAssassin::SubProcBackChannel->new();
+  my $selector = '';
+  $backchannel->set_selector(\$selector);
+
+  my @kids;
+  for (1 .. $njobs) {
+    $backchannel->setup_backchannel_parent_pre_fork();
+    my $pid = fork();
+    die "archive-iterator: fork failed: $!" if !defined $pid;
+
+    if ($pid == 0) {
+      # the other workers' sockets are no business of ours
+      close $_->[1]  foreach @kids;
+      $backchannel->setup_backchannel_child_post_fork();
+      my $fh = $backchannel->get_parent_socket();
+      $fh->blocking(1);
+      $self->_run_worker($fh, $messages);   # does not return
+    }
+
+    $backchannel->setup_backchannel_parent_post_fork($pid);
+    my $fh = $backchannel->get_socket_for_child($pid);
+    $fh->blocking(1);
+    push(@kids, [ $pid, $fh ]);
+  }
+
+  my $total = scalar @{$messages};
+  my $next = 0;         # next message to hand out
+  my $next_result = 0;  # next result to report, with opt_ordered
+  my $pending = 0;      # messages handed out but not answered yet
+  my %ordered;
+  my $error;
+
+  my $eval_ok = eval {
+    foreach my $kid (@kids) {
+      last if $next >= $total;
+      print { $kid->[1] } $next++, "\n";
+      $pending++;
+    }
+
+    while ($pending > 0) {
+      my $nfound = select(my $rout = $selector, undef, undef, undef);
+      if ($nfound < 0) {
+        next if $! == EINTR;
+        die "archive-iterator: select failed: $!";
+      }
+
+      foreach my $fh ($backchannel->select_vec_to_fh_list($rout)) {
+        my $header = <$fh>;
+        if (!defined $header || $header !~ /^([RE]) (\d+) (\d) (\d+)$/) {
+          die "archive-iterator: lost contact with a worker process\n";
+        }
+        my ($type, $idx, $problem, $len) = ($1, $2, $3, $4);
+
+        my $payload = '';
+        while (length($payload) < $len) {
+          my $nread = read($fh, $payload, $len - length($payload),
+                           length($payload));
+          die "archive-iterator: error reading from worker: $!"
+            if !defined $nread;
+          die "archive-iterator: lost contact with a worker process\n"
+            if !$nread;
+        }
+        $pending--;
+        $self->{access_problem} = 1  if $problem;
+
+        if ($type eq 'E') {
+          # stop handing out work, but let the others finish what they have
+          $error = $payload  if !defined $error;
+          $next = $total;
+          next;
+        }
+
+        if ($next < $total) {
+          print $fh $next++, "\n";
+          $pending++;
+        }
+
+        my($class, $date, $result) =
+          map { s/^1// ? $_ : undef } unpack("(N/a*)*", $payload);
+
+        if (!$self->{opt_ordered}) {
+          &{$self->{result_sub}}($class, $result, $date) if $result;
+          next;
+        }
+
+        $ordered{$idx} = [ $class, $result, $date ];
+        while (exists $ordered{$next_result}) {
+          my $r = delete $ordered{$next_result++};
+          &{$self->{result_sub}}(@{$r}) if $r->[1];
+        }
+      }
+    }
+    1;
+  };
+  my $eval_stat = $@;
+
+  foreach my $kid (@kids) {
+    my($pid, $fh) = @{$kid};
+    print $fh "exit\n";
+    $backchannel->remove_from_selector($fh);
+    $backchannel->delete_socket_for_child($pid);
+    close $fh;
+    waitpid($pid, 0);
+  }
+
+  die $eval_stat  if !$eval_ok;
+  die $error      if defined $error;
+  return ! $self->{access_problem};
+}
+
+sub _run_worker {
+  my ($self, $fh, $messages) = @_;
+
+  while (defined(my $line = <$fh>)) {
+    last if $line !~ /^(\d+)$/;
+    my $idx = $1;
+
+    my @result;
+    my $ok = eval { @result = $self->_run_message($messages->[$idx]); 1 };
+
+    my $type = 'R';
+    my $payload;
+    if ($ok) {
+      $payload = pack("(N/a*)*",
+              map { defined $_ ? "1$_" : '0' } @result[0,2,4]);
+    } else {
+      $type = 'E';
+      $payload = $@ ne '' ? $@ : "archive-iterator: worker failed\n";
+    }
+    print $fh join(' ', $type, $idx, $self->{access_problem} ? 1 : 0,
+                   length($payload)), "\n", $payload;
+    $self->{access_problem} = 0;
+  }
+
+  eval { &{$self->{worker_exit_sub}}() if $self->{worker_exit_sub}; 1 }
+    or warn "archive-iterator: worker exit: $@";
+  close $fh;
+
+  # no END blocks or destructors: those belong to the parent
+  POSIX::_exit(0);
+}
+
+############################################################################
+
 ## run_message and related functions to process a single message
 
 sub _run_message {
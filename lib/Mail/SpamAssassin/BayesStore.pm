@@ -800,6 +800,22 @@ sub get_magic_re {
   die "bayes: get_magic_re: not implemented\n";
 }
 
+=item token_hash
+
+public instance (String) token_hash ()
+
+Description:
+This method returns the name of the hash function (C<sha1> or C<md5>) the
+tokens in the database were created with.  Implementations which do not
+record it in the database only ever hold SHA1 tokens.
+
+=cut
+
+sub token_hash {
+  my ($self) = @_;
+  return 'sha1';
+}
+
 =item sync
 
 public instance (Boolean) sync (\% $opts)
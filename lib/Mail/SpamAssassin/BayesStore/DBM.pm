@@ -40,13 +40,17 @@ use Mail::SpamAssassin::Logger;
 
 use constant MAGIC_RE    => qr/^\015\001\007\011\003/;
 
+# width, in seconds, of the token atime histogram buckets
+use constant ATIME_BUCKET_SIZE => 3600;
+
 use vars qw{
   @ISA
   @DBNAMES
   $NSPAM_MAGIC_TOKEN $NHAM_MAGIC_TOKEN $LAST_EXPIRE_MAGIC_TOKEN $LAST_JOURNAL_SYNC_MAGIC_TOKEN
   $NTOKENS_MAGIC_TOKEN $OLDEST_TOKEN_AGE_MAGIC_TOKEN $LAST_EXPIRE_REDUCE_MAGIC_TOKEN
   $RUNNING_EXPIRE_MAGIC_TOKEN $DB_VERSION_MAGIC_TOKEN $LAST_ATIME_DELTA_MAGIC_TOKEN
-  $NEWEST_TOKEN_AGE_MAGIC_TOKEN
+  $NEWEST_TOKEN_AGE_MAGIC_TOKEN $TOKEN_HASH_MAGIC_TOKEN
+  $ATIME_HISTOGRAM_MAGIC_TOKEN $ATIME_BUCKET_MAGIC_PREFIX
 };
 
 @ISA = qw( Mail::SpamAssassin::BayesStore );
@@ -96,6 +100,14 @@ $NSPAM_MAGIC_TOKEN		= "\015\001\007\011\003NSPAM";
 $NTOKENS_MAGIC_TOKEN		= "\015\001\007\011\003NTOKENS";
 $OLDEST_TOKEN_AGE_MAGIC_TOKEN	= "\015\001\007\011\003OLDESTAGE";
 $RUNNING_EXPIRE_MAGIC_TOKEN	= "\015\001\007\011\003RUNNINGEXPIRE";
+$TOKEN_HASH_MAGIC_TOKEN		= "\015\001\007\011\003TOKENHASH";
+
+# The number of tokens per ATIME_BUCKET_SIZE atime bucket is kept in
+# ATIMEBUCKET<n> tokens, so expiry can pick its atime delta without
+# reading every token.  ATIMEHIST is set if those counts are complete,
+# ie. they have been maintained since the db was created or last expired.
+$ATIME_HISTOGRAM_MAGIC_TOKEN	= "\015\001\007\011\003ATIMEHIST";
+$ATIME_BUCKET_MAGIC_PREFIX	= "\015\001\007\011\003ATIMEBUCKET";
 
 sub HAS_DBM_MODULE {
   my ($self) = @_;
@@ -210,6 +222,9 @@ sub tie_db_readonly {
     return 0;
   }
 
+  $self->_read_token_hash();
+  $self->{atime_histogram} = $self->{db_toks}->{$ATIME_HISTOGRAM_MAGIC_TOKEN};
+
   $self->{already_tied} = 1;
   return 1;
 
@@ -319,9 +334,15 @@ sub tie_db_writable {
   elsif (!$found) { # new DB, make sure we know that ...
     $self->{db_version} = $self->{db_toks}->{$DB_VERSION_MAGIC_TOKEN} = $self->DB_VERSION;
     $self->{db_toks}->{$NTOKENS_MAGIC_TOKEN} = 0; # no tokens in the db ...
+    $self->{db_toks}->{$TOKEN_HASH_MAGIC_TOKEN} =
+      $main->{conf}->{bayes_token_hash};
+    $self->{db_toks}->{$ATIME_HISTOGRAM_MAGIC_TOKEN} = 1;
     dbg("bayes: new db, set db version ".$self->{db_version}." and 0 tokens");
   }
 
+  $self->_read_token_hash();
+  $self->{atime_histogram} = $self->{db_toks}->{$ATIME_HISTOGRAM_MAGIC_TOKEN};
+
   $self->{already_tied} = 1;
   return 1;
 
@@ -344,6 +365,27 @@ failed_to_tie:
   return 0;
 }
 
+# Which hash were the tokens in this DB created with?  DBs which predate
+# the TOKENHASH magic token were always hashed with SHA1.
+sub _read_token_hash {
+  my ($self) = @_;
+
+  my $token_hash = $self->{db_toks}->{$TOKEN_HASH_MAGIC_TOKEN};
+  $self->{token_hash} = defined $token_hash ? untaint_var($token_hash) : 'sha1';
+
+  my $conf_hash = $self->{bayes}->{main}->{conf}->{bayes_token_hash};
+  if ($self->{token_hash} ne $conf_hash) {
+    dbg("bayes: db tokens are hashed with %s, not bayes_token_hash %s; ".
+        "clear and retrain the db to switch", $self->{token_hash}, $conf_hash);
+  }
+}
+
+sub token_hash {
+  my ($self) = @_;
+  return $self->{token_hash} if defined $self->{token_hash};
+  return $self->{bayes}->{main}->{conf}->{bayes_token_hash};
+}
+
 # Do we understand how to deal with this DB version?
 sub _check_db_version {
   my ($self) = @_;
@@ -628,6 +670,8 @@ sub untie_db {
 
   $self->{already_tied} = 0;
   $self->{db_version} = undef;
+  $self->{token_hash} = undef;
+  $self->{atime_histogram} = undef;
 }
 
 ###########################################################################
@@ -635,6 +679,12 @@ sub untie_db {
 sub calculate_expire_delta {
   my ($self, $newest_atime, $start, $max_expire_mult) = @_;
 
+  if ($self->{atime_histogram}) {
+    my $delta = $self->_calculate_expire_delta_from_histogram(
+                              $newest_atime, $start, $max_expire_mult);
+    return %{$delta} if ($delta);
+  }
+
   my %delta;  # use a hash since an array is going to be very sparse
 
   # do the first pass, figure out atime delta
@@ -661,6 +711,41 @@ sub calculate_expire_delta {
   return %delta;
 }
 
+# Same as above, but from the per-bucket token counts instead of a pass
+# over the whole db.  Every token in a bucket is taken to be as new as the
+# end of its bucket, so this never overestimates what a delta would expire.
+# Returns a hashref, empty if no token is old enough to expire, or undef if
+# the histogram can't be used and the db has to be scanned.
+sub _calculate_expire_delta_from_histogram {
+  my ($self, $newest_atime, $start, $max_expire_mult) = @_;
+
+  my $oldest_atime = $self->{db_toks}->{$OLDEST_TOKEN_AGE_MAGIC_TOKEN};
+  return if (!$oldest_atime || $oldest_atime > $newest_atime);
+
+  my $first = int($oldest_atime / ATIME_BUCKET_SIZE);
+  my $last = int($newest_atime / ATIME_BUCKET_SIZE);
+  if ($last - $first > 100000) {
+    dbg("bayes: atime histogram spans too many buckets, scanning db instead");
+    return;
+  }
+
+  my %delta;
+  for my $bucket ($first .. $last) {
+    my $count = $self->{db_toks}->{$ATIME_BUCKET_MAGIC_PREFIX.$bucket};
+    next if (!$count || $count < 0);
+
+    my $token_age = $newest_atime - (($bucket+1) * ATIME_BUCKET_SIZE - 1);
+    for (my $i = 1; $i <= $max_expire_mult; $i<<=1) {
+      last if ($token_age < $start * $i);
+      $delta{$i} += $count;
+    }
+  }
+
+  dbg("bayes: expire delta taken from atime histogram, %d buckets",
+      $last - $first + 1);
+  return \%delta;
+}
+
 ###########################################################################
 
 sub token_expiration {
@@ -692,6 +777,7 @@ sub token_expiration {
               (oct ($main->{conf}->{bayes_file_mode}) & 0666);
   umask $umask;
   my $oldest;
+  my %histogram;
 
   my $showdots = $opts->{showdots};
   if ($showdots) { print STDERR "\n"; }
@@ -720,6 +806,7 @@ sub token_expiration {
       }
 
       $new_toks{$tok} = $self->tok_pack ($ts, $th, $atime); $kept++;
+      $histogram{int($atime / ATIME_BUCKET_SIZE)}++;
       if (!defined($oldest) || $atime < $oldest) { $oldest = $atime; }
       if ($ts + $th == 1) {
 	$num_hapaxes++;
@@ -736,6 +823,7 @@ sub token_expiration {
 
   # and add the magic tokens.  don't add the expire_running token.
   $new_toks{$DB_VERSION_MAGIC_TOKEN} = $self->DB_VERSION;
+  $new_toks{$TOKEN_HASH_MAGIC_TOKEN} = $self->token_hash();
 
   # We haven't changed messages of each type seen, so just copy over.
   $new_toks{$NSPAM_MAGIC_TOKEN} = $vars[1];
@@ -750,6 +838,12 @@ sub token_expiration {
   $new_toks{$OLDEST_TOKEN_AGE_MAGIC_TOKEN} = $oldest;
   $new_toks{$LAST_EXPIRE_REDUCE_MAGIC_TOKEN} = $deleted;
 
+  # the new db starts out with a complete atime histogram
+  while (my ($bucket, $count) = each %histogram) {
+    $new_toks{$ATIME_BUCKET_MAGIC_PREFIX.$bucket} = $count;
+  }
+  $new_toks{$ATIME_HISTOGRAM_MAGIC_TOKEN} = 1;
+
   # Sanity check: if we expired too many tokens, abort!
   if ($kept < 100000) {
     dbg("bayes: token expiration would expire too many tokens, aborting");
@@ -880,6 +974,9 @@ sub tok_get {
 sub tok_get_all {
   my ($self, @tokens) = @_;
 
+  # current db formats are unpacked in one batch, see tok_unpack_all()
+  return $self->tok_unpack_all(\@tokens)  if $self->{db_version} >= 1;
+
   my @tokensdata;
   foreach my $token (@tokens) {
     my ($tok_spam, $tok_ham, $atime) = $self->tok_unpack($self->{db_toks}->{$token});
@@ -1251,6 +1348,7 @@ sub _sync_journal_trapped {
   my $count = 0;
   my $total_count = 0;
   my %tokens;
+  my %counts;
   my $showdots = $opts->{showdots};
   my $retirepath = $path.".old";
 
@@ -1296,9 +1394,17 @@ sub _sync_journal_trapped {
 	my $tok = pack("H*",$2);
 	$tokens{$tok} = $1+0 if (!exists $tokens{$tok} || $1+0 > $tokens{$tok});
       } elsif (/^c (-?\d+) (-?\d+) (\d+) (.+)$/) { # Add/full token update
+	# keep the running counts in memory, so each token is read and
+	# written only once no matter how many learned messages it was in
 	my $tok = pack("H*",$4);
-	$self->tok_sync_counters ($1+0, $2+0, $3+0, $tok);
-	$count++;
+	my $cur = $counts{$tok} ||= [ $self->tok_get($tok) ];
+	$cur->[0] += $1; $cur->[0] = 0 if ($cur->[0] < 0);
+	$cur->[1] += $2; $cur->[1] = 0 if ($cur->[1] < 0);
+	$cur->[2] = $3+0 if ($3 > $cur->[2]);
+	# replayed one by one, a token whose counts drop to zero is deleted
+	# and comes back with the atime of the next entry, so forget its
+	# atime here too
+	$cur->[2] = 0 if (!$cur->[0] && !$cur->[1]);
       } elsif (/^n (-?\d+) (-?\d+)$/) { # update ham/spam count
 	$self->tok_sync_nspam_nham ($1+0, $2+0);
 	$count++;
@@ -1319,6 +1425,20 @@ sub _sync_journal_trapped {
                 : die "error reading journal file: $!";
     close(JOURNAL) or die "Can't close journal file: $!";
 
+    # Write out the final counter values first, then the atime updates,
+    # same as the journal order would have had it.  After a bulk learn
+    # with --no-sync this is one write per distinct token rather than
+    # one per token per message, and it's those writes that $count counts.
+    while (my ($k,$v) = each %counts) {
+      $self->tok_put ($k, @{$v});
+
+      if ((++$count % 1000) == 0) {
+	if ($showdots) { print STDERR "."; }
+	$self->set_running_expire_tok();
+      }
+    }
+    undef %counts;
+
     # Now that we've determined what tokens we need to update and their
     # final values, update the DB.  Should be much smaller than the full
     # journal entries.
@@ -1389,12 +1509,21 @@ sub tok_put {
   # use defined() rather than exists(); the latter is not supported
   # by NDBM_File, believe it or not.  Using defined() did not
   # indicate any noticeable speed hit in my testing. (Mar 31 2003 jm)
-  my $exists_already = defined $self->{db_toks}->{$tok};
+  my $oldvalue = $self->{db_toks}->{$tok};
+  my $exists_already = defined $oldvalue;
+
+  # keep the atime histogram up to date; moving within a bucket is free
+  my $oldbucket;
+  if ($exists_already && $self->{atime_histogram}) {
+    $oldbucket = int(($self->tok_unpack($oldvalue))[2] / ATIME_BUCKET_SIZE);
+  }
 
   if ($ts == 0 && $th == 0) {
     return if (!$exists_already); # If the token doesn't exist, just return
     $self->{db_toks}->{$NTOKENS_MAGIC_TOKEN}--;
     delete $self->{db_toks}->{$tok};
+    $self->{db_toks}->{$ATIME_BUCKET_MAGIC_PREFIX.$oldbucket}--
+      if (defined $oldbucket);
   } else {
     if (!$exists_already) { # If the token doesn't exist, raise the token count
       $self->{db_toks}->{$NTOKENS_MAGIC_TOKEN}++;
@@ -1402,6 +1531,15 @@ sub tok_put {
 
     $self->{db_toks}->{$tok} = $self->tok_pack ($ts, $th, $atime);
 
+    if ($self->{atime_histogram}) {
+      my $bucket = int($atime / ATIME_BUCKET_SIZE);
+      if (!defined $oldbucket || $bucket != $oldbucket) {
+        $self->{db_toks}->{$ATIME_BUCKET_MAGIC_PREFIX.$bucket}++;
+        $self->{db_toks}->{$ATIME_BUCKET_MAGIC_PREFIX.$oldbucket}--
+          if (defined $oldbucket);
+      }
+    }
+
     my $newmagic = $self->{db_toks}->{$NEWEST_TOKEN_AGE_MAGIC_TOKEN};
     if (!defined ($newmagic) || $atime > $newmagic) {
       $self->{db_toks}->{$NEWEST_TOKEN_AGE_MAGIC_TOKEN} = $atime;
@@ -1598,6 +1736,7 @@ sub backup_database {
   print "v\t$vars[6]\tdb_version # this must be the first line!!!\n";
   print "v\t$vars[1]\tnum_spam\n";
   print "v\t$vars[2]\tnum_nonspam\n";
+  print "v\t".$self->token_hash()."\ttoken_hash\n";
 
   while (my ($tok, $packed) = each %{$self->{db_toks}}) {
     next if ($tok =~ MAGIC_RE); # skip magic tokens
@@ -1667,6 +1806,7 @@ sub restore_database {
   my $token_count = 0;
   my $num_spam;
   my $num_ham;
+  my $token_hash = 'sha1'; # backups without a token_hash line are SHA1
   my $error_p = 0;
   my $newest_token_age = 0;
   # Kinda wierd I know, but we need a nice big value and we know there will be
@@ -1714,12 +1854,15 @@ sub restore_database {
 
     if ($line =~ /^v\s+/) { # variable line
       my @parsed_line = split(/\s+/, $line, 3);
-      my $value = $parsed_line[1] + 0;
+      my $value = $parsed_line[1];
       if ($parsed_line[2] eq 'num_spam') {
-	$num_spam = $value;
+	$num_spam = $value + 0;
       }
       elsif ($parsed_line[2] eq 'num_nonspam') {
-	$num_ham = $value;
+	$num_ham = $value + 0;
+      }
+      elsif ($parsed_line[2] eq 'token_hash' && $value =~ /^(sha1|md5)$/) {
+	$token_hash = $1;
       }
       else {
 	dbg("bayes: restore_database: skipping unknown line: $line");
@@ -1829,6 +1972,7 @@ sub restore_database {
 
   # set the calculated magic tokens
   $new_toks{$DB_VERSION_MAGIC_TOKEN} = $self->DB_VERSION();
+  $new_toks{$TOKEN_HASH_MAGIC_TOKEN} = $token_hash;
   $new_toks{$NTOKENS_MAGIC_TOKEN} = $token_count;
   $new_toks{$NSPAM_MAGIC_TOKEN} = $num_spam;
   $new_toks{$NHAM_MAGIC_TOKEN} = $num_ham;
@@ -1928,6 +2072,35 @@ sub tok_unpack {
   }
 }
 
+# Look up and unpack a list of tokens for a version 1+ db in one go, as
+# tok_unpack() would, skipping the method call per token.  Tokens which
+# aren't in the db are left out, as they carry no information.
+sub tok_unpack_all {
+  my ($self, $tokens) = @_;
+
+  my $db_toks = $self->{db_toks};
+  my @tokensdata;
+  foreach my $token (@{$tokens}) {
+    my $value = $db_toks->{$token};
+    next unless defined $value;
+
+    my $packed = unpack("C", $value);
+    if (($packed & FORMAT_FLAG) == ONE_BYTE_FORMAT) {
+      my $atime = unpack("x V", $value);
+      push(@tokensdata, [$token, ($packed & ONE_BYTE_SSS_BITS) >> 3,
+                         $packed & ONE_BYTE_HHH_BITS, $atime || 0]);
+    }
+    elsif (($packed & FORMAT_FLAG) == TWO_LONGS_FORMAT) {
+      my ($ts, $th, $atime) = unpack("x VVV", $value);
+      push(@tokensdata, [$token, $ts || 0, $th || 0, $atime || 0]);
+    }
+    else {
+      warn "bayes: unknown packing format for bayes db, please re-learn: $packed";
+    }
+  }
+  return \@tokensdata;
+}
+
 sub tok_pack {
   my ($self, $ts, $th, $atime) = @_;
   $ts ||= 0; $th ||= 0; $atime ||= 0;
@@ -418,11 +418,13 @@ sub _open_db {
 
   if (!$self->{db_version}) {
     $self->{db_version} = $self->DB_VERSION;
+    $self->{token_hash} = $self->{bayes}->{conf}->{bayes_token_hash};
     my $ret = $self->{redis}->call('MSET',
                                    'v:DB_VERSION', $self->{db_version},
                                    'v:NSPAM', 0,
                                    'v:NHAM', 0,
-                                   'v:TOKEN_FORMAT', 2 );
+                                   'v:TOKEN_FORMAT', 2,
+                                   'v:TOKEN_HASH', $self->{token_hash} );
     unless ($ret) {
       warn("bayes: failed to initialize database");
       return 0;
@@ -441,6 +443,14 @@ sub _open_db {
            "consider backup/restore or initialize a database\n");
       return 0;
     }
+    # databases which predate v:TOKEN_HASH hold SHA1 tokens
+    $self->{token_hash} =
+      $self->{redis}->call('GET', 'v:TOKEN_HASH') || 'sha1';
+    if ($self->{token_hash} ne $self->{bayes}->{conf}->{bayes_token_hash}) {
+      dbg("bayes: db tokens are hashed with %s, not bayes_token_hash %s; ".
+          "clear and retrain the db to switch",
+          $self->{token_hash}, $self->{bayes}->{conf}->{bayes_token_hash});
+    }
   }
 
   if ($self->{have_lua} && !defined $self->{multi_hmget_script}) {
@@ -911,10 +921,11 @@ sub tok_touch_all {
   # which offers efficient command batching (pipelining) - with the Redis
   # CPAN module the batched case would be worse by about 33% on the average.
 
-  # We just refresh TTL on all
+  # We just refresh TTL on all.  The replies are of no interest, so don't
+  # make the scan wait for them; they are collected with the next request.
 
   $r->b_call('EXPIRE', 'w:'.$_, $ttl) for @$tokens;
-  $r->b_results;  # collect response, ignoring results
+  $r->b_send;
 
   return 1;
 }
@@ -944,6 +955,22 @@ This method returns a regexp which indicates a magic token.
 
 use constant get_magic_re => undef;
 
+=head2 token_hash
+
+public instance (String) token_hash ()
+
+Description:
+Returns the hash function the tokens in the database were created with,
+as recorded in v:TOKEN_HASH when the database was initialized.
+
+=cut
+
+sub token_hash {
+  my($self) = @_;
+  return $self->{token_hash} if defined $self->{token_hash};
+  return $self->{bayes}->{conf}->{bayes_token_hash};
+}
+
 =head2 sync
 
 public instance (Boolean) sync (\% $opts)
@@ -1104,6 +1131,7 @@ sub backup_database {
   print "v\t$vars[0]\tdb_version # this must be the first line!!!\n";
   print "v\t$vars[1]\tnum_spam\n";
   print "v\t$vars[2]\tnum_nonspam\n";
+  print "v\t".$self->token_hash."\ttoken_hash\n";
 
   # let's get past this terrible command as fast as possible
   my $keys = $r->call('KEYS', 'w:*');
@@ -1211,6 +1239,7 @@ sub restore_database {
   my $db_version;
   my $num_spam = 0;
   my $num_ham = 0;
+  my $token_hash = 'sha1';  # backups without a token_hash line are SHA1
   my $line_count = 0;
 
   my $line = <DUMPFILE>;
@@ -1307,11 +1336,13 @@ sub restore_database {
 
     } elsif ($line =~ /^v\s+/) {  # variable line
       my @parsed_line = split(/\s+/, $line, 3);
-      my $value = $parsed_line[1] + 0;
+      my $value = $parsed_line[1];
       if ($parsed_line[2] eq 'num_spam') {
-        $num_spam = $value;
+        $num_spam = $value + 0;
       } elsif ($parsed_line[2] eq 'num_nonspam') {
-        $num_ham = $value;
+        $num_ham = $value + 0;
+      } elsif ($parsed_line[2] eq 'token_hash' && $value =~ /^(sha1|md5)$/) {
+        $token_hash = $1;
       } else {
         dbg("bayes: restore_database: skipping unknown line: $line");
       }
@@ -1338,6 +1369,8 @@ sub restore_database {
   else {
     $self->nspam_nham_change($num_spam, $num_ham);
   }
+  $r->call('SET', 'v:TOKEN_HASH', $token_hash);
+  $self->{token_hash} = $token_hash;
 
   dbg("bayes: parsed $line_count lines");
   dbg("bayes: created database with $token_count tokens ".
@@ -1152,6 +1152,24 @@ Unicode.  Requires the Encode::Detect module, HTML::Parser version
     }
   });
 
+=item attachment_decode_budget n        (default: 0)
+
+How many bytes of attachments, that is parts other than text/* and
+message/*, may be decoded in full per message, all of them together.  Once
+that's used up, only the start of any further attachment is decoded, up to
+what is left.  The plugins which come with SpamAssassin only decode the
+first few kilobytes of an attachment anyway, but third-party plugins may
+decode all of them, so this keeps the time and memory spent on a message
+with many large attachments bounded.  0 means no limit.
+
+=cut
+
+  push (@cmds, {
+    setting => 'attachment_decode_budget',
+    default => 0,
+    type => $CONF_TYPE_NUMERIC,
+  });
+
 
 =back
 
@@ -3290,6 +3308,62 @@ general running of SpamAssassin.
     }
   });
 
+=item skip_unneeded_subrules (0|1)		(default: 0)
+
+If set to 1, a header, body, rawbody, uri or full sub-rule (one whose name
+starts with '__') which is only used by meta rules is not run when the
+rules which have already run decide all of those meta rules anyway.  For
+example, with
+
+  header __FROM_X   From =~ /x/
+  body   __BODY_Y   /y/
+  meta   META_XY    __FROM_X && __BODY_Y
+
+C<__BODY_Y> is skipped for a message whose C<From> header does not
+contain 'x'.  Only meta rules made up of rule names, C<&&>, C<||>, C<!>
+and parentheses are considered; ones using arithmetic or comparisons
+always have all their sub-rules run.
+
+Sub-rules which were skipped do not appear in the list of sub-tests hit,
+so leave this off when collecting rule hit-frequencies, e.g. with
+mass-check.
+
+=cut
+
+  push (@cmds, {
+    setting => 'skip_unneeded_subrules',
+    is_admin => 1,
+    default => 0,
+    type => $CONF_TYPE_BOOL,
+  });
+
+=item rule_code_cache_dir /path/to/dir		(default: none)
+
+If set, the perl code generated for each set of header, body, uri,
+rawbody, full and meta rules is saved in this directory, and the next
+process to start with the same rules, such as a restarted C<spamd>,
+loads it from there instead of generating it again.  Each file is
+stored with a hash of everything its code was generated from, including
+the text, flags and source of its rules and the SpamAssassin version,
+and is only used if that hash still matches; otherwise the code is
+generated as usual and the file replaced.
+
+The cached code is run as it is loaded, possibly as root (C<spamd>
+compiles its rules before it changes to the C<-u> user), so the directory
+and each file in it are ignored unless they are owned by the user
+SpamAssassin runs as, or by root, and are not group or world writable.
+The directory must exist; nothing is saved if that user can't write to
+it.  Nothing is cached while user rules are allowed (C<allow_user_rules>),
+or while debug logging is on, as the code then differs from run to run.
+
+=cut
+
+  push (@cmds, {
+    setting => 'rule_code_cache_dir',
+    is_admin => 1,
+    type => $CONF_TYPE_STRING,
+  });
+
 =item rbl_timeout t [t_min] [zone]		(default: 15 3)
 
 All DNS queries are made at the beginning of a check and we try to read
@@ -3517,6 +3591,74 @@ module.
     }
   });
 
+=item bayes_token_hash sha1|md5		(default: sha1)
+
+The hash function used to turn each Bayes token into the 40-bit key kept
+in the database.  Only the distribution of the hash matters here, and
+C<md5> is several times cheaper to compute than C<sha1> for short tokens.
+
+The hash is recorded in a database when it is created, and an existing
+database keeps using the hash it was created with.  Since the database
+only holds hashed tokens they can not be rehashed, so to switch an existing
+database, clear it with C<sa-learn --clear> and retrain it.  Backups made
+with C<sa-learn --backup> carry the hash along to the restored database.
+
+Only the DBM and Redis storage modules record the hash; the other
+storage modules always use C<sha1>.
+
+=cut
+
+  push (@cmds, {
+    setting => 'bayes_token_hash',
+    is_admin => 1,
+    default => 'sha1',
+    type => $CONF_TYPE_STRING,
+    code => sub {
+      my ($self, $key, $value, $line) = @_;
+      local ($1);
+      if ($value !~ /^(sha1|md5)$/) { return $INVALID_VALUE; }
+      $self->{bayes_token_hash} = $1;
+    }
+  });
+
+=item bayes_token_cache_size n		(default: 0)
+
+Keep up to about this many Bayes token counts cached in memory in each
+process (each spamd child), so the most common tokens need not be looked up
+in the Bayes database for every message.  Tokens which are not in the
+database are cached as well.  The cache is dropped whenever the number of
+learned spam or ham messages changes, and when a different user's database
+is used.  The default of 0 disables the cache.
+
+Cache hits are logged in spamd's C<result:> line as
+C<bayes_cache=hits/lookups> for each message.
+
+=cut
+
+  push (@cmds, {
+    setting => 'bayes_token_cache_size',
+    is_admin => 1,
+    default => 0,
+    type => $CONF_TYPE_NUMERIC,
+  });
+
+=item bayes_token_cache_ttl n		(default: 5m, i.e. 5 minutes)
+
+How long a token count cached due to C<bayes_token_cache_size> may be used
+before it is looked up in the database again.  This bounds how stale the
+counts can get while other processes learn into the database.
+A numeric value is optionally suffixed by a time unit (s, m, h, d, w,
+indicating seconds (default), minutes, hours, days, weeks).
+
+=cut
+
+  push (@cmds, {
+    setting => 'bayes_token_cache_ttl',
+    is_admin => 1,
+    default => 5*60,  # seconds
+    type => $CONF_TYPE_DURATION,
+  });
+
 =item bayes_sql_dsn DBI::databasetype:databasename:hostname:port
 
 Used for BayesStore::SQL storage implementation.
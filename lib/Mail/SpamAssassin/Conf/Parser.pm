@@ -861,12 +861,17 @@ sub finish_parsing {
     $self->find_dup_rules();          # must be after fix_priorities()
   }
 
+  if ($conf->{skip_unneeded_subrules}) {
+    $self->compile_meta_dag();        # must be after find_dup_rules()
+  }
+
   dbg("config: finish parsing");
 
   while (my ($name, $text) = each %{$conf->{tests}}) {
     my $type = $conf->{test_types}->{$name};
     my $priority = $conf->{priority}->{$name} || 0;
     $conf->{priorities}->{$priority}++;
+    $conf->{test_types_at_priority}->{$priority}->{$type} = 1;
 
     # eval type handling
     if (($type & 1) == 1) {
@@ -1028,6 +1033,112 @@ sub fix_priorities {
   }
 }
 
+# Build the meta rule graph used by skip_unneeded_subrules: the metas which
+# use each rule; for metas made only of rule names, "&&", "||", "!" and
+# parentheses, a postfix program which can be run while some of its inputs
+# are still unknown; and the "__" sub-rules which are worth checking before
+# they are run.  See PerMsgStatus::subrule_needed().
+sub compile_meta_dag {
+  my ($self) = @_;
+  my $conf = $self->{conf};
+
+  # the rule types which are complete once their turn at a priority is
+  # over; eval rules can finish later, eg. once DNS answers come in
+  my %known_types = (
+    $Mail::SpamAssassin::Conf::TYPE_HEAD_TESTS    => 'head',
+    $Mail::SpamAssassin::Conf::TYPE_BODY_TESTS    => 'body',
+    $Mail::SpamAssassin::Conf::TYPE_URI_TESTS     => 'uri',
+    $Mail::SpamAssassin::Conf::TYPE_RAWBODY_TESTS => 'rawbody',
+    $Mail::SpamAssassin::Conf::TYPE_FULL_TESTS    => 'full',
+    $Mail::SpamAssassin::Conf::TYPE_META_TESTS    => 'meta',
+  );
+
+  my (%consumers, %program, %ruletype);
+  my $lexer = ARITH_EXPRESSION_LEXER;
+  while (my ($name, $text) = each %{$conf->{tests}}) {
+    my $type = $known_types{$conf->{test_types}->{$name}};
+    next unless defined $type;
+    $ruletype{$name} = $type;
+    next unless $type eq 'meta';
+
+    my @tokens = ($text =~ m/$lexer/g);
+    my %seen;
+    foreach my $token (@tokens) {
+      next if $token !~ /^[A-Za-z_][A-Za-z0-9_]*\z/s;
+      push(@{$consumers{$token}}, $name)  unless $seen{$token}++;
+    }
+    my $program = _meta_to_postfix(@tokens);
+    $program{$name} = $program  if $program;
+  }
+
+  my %skippable;
+  foreach my $name (keys %consumers) {
+    my $type = $ruletype{$name};
+    next unless $name =~ /^__/ && defined $type && $type ne 'meta';
+    # its duplicates get their hits from it, and may be scored
+    next if $conf->{duplicate_rules}->{$name};
+    # a meta using arithmetic is never known before it is run
+    next if grep { !$program{$_} } @{$consumers{$name}};
+    $skippable{$name} = 1;
+  }
+
+  dbg("rules: %d meta rules can be decided early, %d subrules may be skipped",
+      scalar keys %program, scalar keys %skippable);
+
+  $conf->{meta_dag} = {
+    consumers => \%consumers,
+    program   => \%program,
+    ruletype  => \%ruletype,
+    skippable => \%skippable,
+  };
+}
+
+# convert a lexed boolean meta rule to postfix, eg. "A && !(B || C)" to
+# "A B C || ! &&"; returns undef for anything else
+sub _meta_to_postfix {
+  my @tokens = @_;
+  my %prec = ('||' => 1, '&&' => 2, '!' => 3);
+  my (@out, @ops);
+
+  foreach my $token (@tokens) {
+    if ($token =~ /^[A-Za-z_][A-Za-z0-9_]*\z/s) {
+      push(@out, untaint_var($token));
+    }
+    elsif ($token eq '!' || $token eq '(') {
+      push(@ops, $token);
+    }
+    elsif ($token eq ')') {
+      push(@out, pop @ops)  while @ops && $ops[-1] ne '(';
+      return unless @ops;
+      pop @ops;
+    }
+    elsif ($token eq '&&' || $token eq '||') {
+      push(@out, pop @ops)
+        while @ops && $ops[-1] ne '(' && $prec{$ops[-1]} >= $prec{$token};
+      push(@ops, $token);
+    }
+    else {
+      return;   # numbers, arithmetic and comparisons
+    }
+  }
+  while (@ops) {
+    my $op = pop @ops;
+    return if $op eq '(';
+    push(@out, $op);
+  }
+
+  # check that every operator has its operands, and one value is left
+  my $depth = 0;
+  foreach my $op (@out) {
+    if ($op eq '!') { return if $depth < 1 }
+    elsif ($op eq '&&' || $op eq '||') { return if $depth < 2; $depth-- }
+    else { $depth++ }
+  }
+  return if $depth != 1;
+
+  return \@out;
+}
+
 sub find_dup_rules {
   my ($self) = @_;
   my $conf = $self->{conf};
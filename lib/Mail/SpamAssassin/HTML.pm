@@ -55,16 +55,21 @@ my %elements_text_style = map {; $_ => 1 }
   qw( body font table tr th td big small basefont marquee span p div ),
 ;
 
-# elements that insert whitespace
-my %elements_whitespace = map {; $_ => 1 }
-  qw( br div li th td dt dd p hr blockquote pre embed listing plaintext xmp title 
-    h1 h2 h3 h4 h5 h6 ),
-;
+# elements that insert whitespace, and the whitespace they insert
+my %elements_whitespace = (
+  (map {; $_ => "\n" } qw( br div )),
+  (map {; $_ => " " } qw( li th td dt dd embed h1 h2 h3 h4 h5 h6 )),
+  (map {; $_ => "\n\n" }
+    qw( p hr blockquote pre listing plaintext xmp title )),
+);
 
-# elements that push URIs
-my %elements_uri = map {; $_ => 1 }
-  qw( body table tr td a area link img frame iframe embed script form base bgsound ),
-;
+# elements that push URIs, and the attribute the URI is in
+my %elements_uri = (
+  (map {; $_ => "background" } qw( body table tr td )),
+  (map {; $_ => "href" } qw( a area link base )),
+  (map {; $_ => "src" } qw( img frame iframe embed script bgsound )),
+  form => "action",
+);
 
 # style attribute not accepted
 #my %elements_no_style = map {; $_ => 1 }
@@ -258,7 +263,8 @@ sub parse {
 sub html_tag {
   my ($self, $tag, $attr, $num) = @_;
 
-  my $maybe_namespace = ($tag =~ m@^(?:o|st\d):[\w-]+/?$@);
+  my $maybe_namespace =
+    (index($tag, ':') > 0 && $tag =~ m@^(?:o|st\d):[\w-]+/?$@);
 
   if (exists $elements{$tag} || $maybe_namespace) {
     $self->{elements}++;
@@ -297,15 +303,9 @@ sub html_tag {
 sub html_whitespace {
   my ($self, $tag) = @_;
 
-  # ordered by frequency of tag groups, note: whitespace is always "visible"
-  if ($tag eq "br" || $tag eq "div") {
-    $self->display_text("\n", whitespace => 1);
-  }
-  elsif ($tag =~ /^(?:li|t[hd]|d[td]|embed|h\d)$/) {
-    $self->display_text(" ", whitespace => 1);
-  }
-  elsif ($tag =~ /^(?:p|hr|blockquote|pre|listing|plaintext|xmp|title)$/) {
-    $self->display_text("\n\n", whitespace => 1);
+  # note: whitespace is always "visible"
+  if (exists $elements_whitespace{$tag}) {
+    $self->display_text($elements_whitespace{$tag}, whitespace => 1);
   }
 }
 
@@ -316,8 +316,6 @@ sub push_uri {
 
   $uri = $self->canon_uri($uri);
 
-  my $target = target_uri($self->{base_href} || "", $uri);
-
   # skip things like <iframe src="" ...>
   if (length $uri) {
     $self->{uri}->{$uri}->{types}->{$type} = 1;
@@ -343,28 +341,15 @@ sub canon_uri {
 sub html_uri {
   my ($self, $tag, $attr) = @_;
 
-  # ordered by frequency of tag groups
-  if ($tag =~ /^(?:body|table|tr|td)$/) {
-    if (defined $attr->{background}) {
-      $self->push_uri($tag, $attr->{background});
-    }
-  }
-  elsif ($tag =~ /^(?:a|area|link)$/) {
-    if (defined $attr->{href}) {
-      $self->push_uri($tag, $attr->{href});
-    }
-  }
-  elsif ($tag =~ /^(?:img|frame|iframe|embed|script|bgsound)$/) {
-    if (defined $attr->{src}) {
-      $self->push_uri($tag, $attr->{src});
-    }
-  }
-  elsif ($tag eq "form") {
-    if (defined $attr->{action}) {
-      $self->push_uri($tag, $attr->{action});
+  return unless exists $elements_uri{$tag};
+
+  if ($tag ne "base") {
+    my $uri = $attr->{$elements_uri{$tag}};
+    if (defined $uri) {
+      $self->push_uri($tag, $uri);
     }
   }
-  elsif ($tag eq "base") {
+  else {
     if (my $uri = $attr->{href}) {
       $uri = $self->canon_uri($uri);
 
@@ -415,8 +400,8 @@ sub close_tag {
   return if !grep { $_->{tag} eq $tag } @{ $self->{text_style} };
 
   # close everything up to and including tag
-  while (my %current = %{ pop @{ $self->{text_style} } }) {
-    last if $current{tag} eq $tag;
+  while (my $current = pop @{ $self->{text_style} }) {
+    last if $current->{tag} eq $tag;
   }
 }
 
@@ -447,6 +432,7 @@ sub text_style {
 
     # copy current text state
     my %new = %{ $self->{text_style}[-1] };
+    delete $new{invisible};
 
     # change tag name!
     $new{tag} = $tag;
@@ -535,11 +521,23 @@ sub text_style {
 sub html_font_invisible {
   my ($self, $text) = @_;
 
-  my $fg = $self->{text_style}[-1]->{fgcolor};
-  my $bg = $self->{text_style}[-1]->{bgcolor};
-  my $size = $self->{text_style}[-1]->{size};
-  my $display = $self->{text_style}[-1]->{style_display};
-  my $visibility = $self->{text_style}[-1]->{style_visibility};
+  # this only depends on the text style, so only work it out once for each
+  # one rather than for every piece of text in it
+  my $style = $self->{text_style}[-1];
+  if (!exists $style->{invisible}) {
+    $style->{invisible} = $self->_style_invisible($style);
+  }
+  return $style->{invisible};
+}
+
+sub _style_invisible {
+  my ($self, $style) = @_;
+
+  my $fg = $style->{fgcolor};
+  my $bg = $style->{bgcolor};
+  my $size = $style->{size};
+  my $display = $style->{style_display};
+  my $visibility = $style->{style_visibility};
 
   # invisibility
   if (substr($fg,-6) eq substr($bg,-6)) {
@@ -692,33 +690,34 @@ sub display_text {
     }
   }
   push @{ $self->{text} }, $text;
+  my $index = $#{ $self->{text} };
   while (my ($k, $v) = each %display) {
-    my $textvar = "text_".$k;
-    if (!exists $self->{$textvar}) { $self->{$textvar} = ''; }
-    vec($self->{$textvar}, $#{$self->{text}}, 1) = $v;
+    # vec() creates the bit string if this is the first time
+    vec($self->{"text_$k"}, $index, 1) = $v;
   }
 }
 
 sub html_text {
   my ($self, $text) = @_;
+  my $inside = $self->{inside} ||= {};
 
   # text that is not part of body
-  if (exists $self->{inside}{script} && $self->{inside}{script} > 0)
+  if (exists $inside->{script} && $inside->{script} > 0)
   {
     push @{ $self->{script} }, $text;
     return;
   }
-  if (exists $self->{inside}{style} && $self->{inside}{style} > 0) {
+  if (exists $inside->{style} && $inside->{style} > 0) {
     return;
   }
 
   # text that is part of body and also stored separately
-  if (exists $self->{inside}{a} && $self->{inside}{a} > 0) {
+  if (exists $inside->{a} && $inside->{a} > 0) {
     # this doesn't worry about nested anchors
     $self->{uri}->{$self->{anchor_last}}->{anchor_text}->[-1] .= $text;
     $self->{anchor}->[-1] .= $text;
   }
-  if (exists $self->{inside}{title} && $self->{inside}{title} > 0) {
+  if (exists $inside->{title} && $inside->{title} > 0) {
     $self->{title}->[$self->{title_index}] .= $text;
   }
 
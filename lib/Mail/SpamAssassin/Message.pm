@@ -56,6 +56,10 @@ use vars qw(@ISA);
 
 @ISA = qw(Mail::SpamAssassin::Message::Node);
 
+# parts we're not likely to use are written out to a temp file, unless
+# they are this small; the file costs more than the memory it would save
+use constant MAX_PART_SIZE_IN_MEMORY => 65536;
+
 # ---------------------------------------------------------------------------
 
 =item new()
@@ -84,6 +88,10 @@ is always handled when the object is created.
 C<subparse> specifies how many MIME recursion levels should be parsed.
 Defaults to 20.
 
+C<decode_budget> specifies how many bytes of attachments (parts other than
+text/* and message/*) may be decoded in full, all of them together; see
+C<decode()> in Mail::SpamAssassin::Message::Node.  Defaults to 0, no limit.
+
 =cut
 
 # month mappings (ripped from Util.pm)
@@ -107,7 +115,15 @@ sub new {
   # levels deep.
   my $subparse = defined $opts->{'subparse'} ? $opts->{'subparse'} : 20;
 
-  my $self = $class->SUPER::new({normalize=>$normalize});
+  # How many bytes of attachments may be decoded, shared by all the parts
+  # (and those of any message/* parts) as a reference to what's left.
+  my $decode_budget = $opts->{'decode_budget'};
+  if ($decode_budget && !ref $decode_budget) {
+    $decode_budget = \(my $budget_left = $decode_budget);
+  }
+
+  my $self = $class->SUPER::new({normalize=>$normalize,
+                                 decode_budget=>$decode_budget});
 
   $self->{tmpfiles} =           [];
   $self->{pristine_headers} =	'';
@@ -307,31 +323,36 @@ sub new {
   }
 
   # CRLF -> LF  (but avoid expensive operation unless necessary)
-  # also merge multiple blank lines into a single one
-  my $squash_crlf = $self->{line_ending} eq "\015\012";
-  my $start;
-  # iterate over lines in reverse order
-  for (my $cnt=$#message; $cnt>=0; $cnt--) {
-    $message[$cnt] =~ s/\015\012/\012/  if $squash_crlf;
-
-    # line is blank
-    if ($message[$cnt] =~ /^\s*$/) {
-      # /^\s*$/ is about 5% faster then !/\S/, but still expensive here
-      if (!defined $start) {
-        $start=$cnt;
+  if ($self->{line_ending} eq "\015\012") {
+    s/\015\012/\012/  for @message;
+  }
+
+  # also merge multiple blank lines into a single one; going over every
+  # line is expensive on large messages, so only do it when there is a
+  # long enough series of blank lines somewhere to begin with
+  if ($self->{'pristine_body'} =~ /(?:^[^\S\n]*\n){10}/m) {
+    my $start;
+    # iterate over lines in reverse order
+    for (my $cnt=$#message; $cnt>=0; $cnt--) {
+      # line is blank
+      if ($message[$cnt] =~ /^\s*$/) {
+        # /^\s*$/ is about 5% faster then !/\S/, but still expensive here
+        if (!defined $start) {
+          $start=$cnt;
+        }
+        next unless $cnt == 0;
       }
-      next unless $cnt == 0;
-    }
 
-    # line is not blank, or we've reached the beginning
+      # line is not blank, or we've reached the beginning
 
-    # if we've got a series of blank lines, get rid of them
-    if (defined $start) {
-      my $num = $start-$cnt;
-      if ($num > 10) {
-        splice @message, $cnt+2, $num-1;
+      # if we've got a series of blank lines, get rid of them
+      if (defined $start) {
+        my $num = $start-$cnt;
+        if ($num > 10) {
+          splice @message, $cnt+2, $num-1;
+        }
+        undef $start;
       }
-      undef $start;
     }
   }
 
@@ -600,6 +621,7 @@ sub finish {
   delete $self->{'mime_boundary_state'};
   delete $self->{'mbox_sep'};
   delete $self->{'normalize'};
+  delete $self->{'decode_budget'};
   delete $self->{'pristine_body'};
   delete $self->{'pristine_headers'};
   delete $self->{'line_ending'};
@@ -747,6 +769,7 @@ sub parse_body {
     	    message	=>	$toparse->[0]->{'decoded'},
 	    parsenow	=>	0,
 	    normalize	=>	$self->{normalize},
+	    decode_budget =>	$self->{decode_budget},
 	    subparse	=>	$toparse->[3]-1,
 	    });
 
@@ -836,93 +859,34 @@ sub _parse_multipart {
     # Else, there's no boundary, so leave the whole part...
   }
 
-  # prepare a new tree node
-  my $part_msg = Mail::SpamAssassin::Message::Node->new({ normalize=>$self->{normalize} });
-  my $in_body = 0;
-  my $header;
-  my $part_array;
-  my $found_end_boundary;
-
-  my $line_count = @{$body};
-  foreach ( @{$body} ) {
-    # if we're on the last body line, or we find any boundary marker,
-    # deal with the mime part;
+  # Rather than go through the part line by line, find the boundary lines
+  # first; each part's header lines are then looked at one by one, but its
+  # body lines are taken over as a single slice of the array.
+  my @boundaries;
+  if (defined $boundary) {
+    my $boundary_re = qr/^--\Q$boundary\E(?:--)?\s*$/;
     # a triage before an unlikely-to-match regexp avoids a CPU hotspot
-    $found_end_boundary = defined $boundary && substr($_,0,2) eq '--'
-                          && /^--\Q$boundary\E(?:--)?\s*$/;
-    if ( --$line_count == 0 || $found_end_boundary ) {
-      my $line = $_; # remember the last line
-
-      # If at last line and no end boundary found, the line belongs to body
-      # TODO:
-      #  Is $self->{mime_boundary_state}->{$boundary}-- needed here?
-      #  Could "missing end boundary" be a useful rule? Mark it somewhere?
-      #  If SA processed truncated message from amavis etc, this could also
-      #  be hit legimately..
-      if (!$found_end_boundary) {
-        # TODO: This is duplicate code from few pages down below..
-        while (length ($_) > MAX_BODY_LINE_LENGTH) {
-          push (@{$part_array}, substr($_, 0, MAX_BODY_LINE_LENGTH)."\n");
-          substr($_, 0, MAX_BODY_LINE_LENGTH) = '';
-        }
-        push ( @{$part_array}, $_ );
-      }
-      # per rfc 1521, the CRLF before the boundary is part of the boundary:
-      # NOTE: The CRLF preceding the encapsulation line is conceptually
-      # attached to the boundary so that it is possible to have a part
-      # that does not end with a CRLF (line break). Body parts that must
-      # be considered to end with line breaks, therefore, must have two
-      # CRLFs preceding the encapsulation line, the first of which is part
-      # of the preceding body part, and the second of which is part of the
-      # encapsulation boundary.
-      elsif ($part_array) {
-        chomp( $part_array->[-1] );  # trim the CRLF that's part of the boundary
-        splice @{$part_array}, -1 if ( $part_array->[-1] eq '' ); # blank line for the boundary only ...
-      }
-      else {
-        # Invalid parts can have no body, so fake in a blank body
-	# in that case.
-        $part_array = [];
-      }
-
-      my($p_boundary);
-      ($part_msg->{'type'}, $p_boundary) = Mail::SpamAssassin::Util::parse_content_type($part_msg->header('content-type'));
-      $p_boundary ||= $boundary;
-      dbg("message: found part of type ".$part_msg->{'type'}.", boundary: ".(defined $p_boundary ? $p_boundary : ''));
-
-      # we've created a new node object, so add it to the queue along with the
-      # text that belongs to that part, then add the new part to the current
-      # node to create the tree.
-      push(@{$self->{'parse_queue'}}, [ $part_msg, $p_boundary, $part_array, $subparse ]);
-      $msg->add_body_part($part_msg);
-
-      # rfc 1521 says /^--boundary--$/, some MUAs may just require /^--boundary--/
-      # but this causes problems with horizontal lines when the boundary is
-      # made up of dashes as well, etc.
-      if (defined $boundary) {
-        if ($line =~ /^--\Q${boundary}\E--\s*$/) {
-	  # Make a note that we've seen the end boundary
-	  $self->{mime_boundary_state}->{$boundary}--;
-          last;
-        }
-	elsif ($line_count && $body->[-$line_count] !~ /^[\041-\071\073-\176]+:/) {
-          # if we aren't on an end boundary and there are still lines left, it
-	  # means we hit a new start boundary.  therefore, the next line ought
-	  # to be a mime header.  if it's not, mark it.
-	  $self->{'missing_mime_headers'} = 1;
-	}
-      }
-
-      # make sure we start with a new clean node
-      $in_body  = 0;
-      $part_msg = Mail::SpamAssassin::Message::Node->new({ normalize=>$self->{normalize} });
-      undef $part_array;
-      undef $header;
-
-      next;
-    }
+    @boundaries = grep { substr($body->[$_],0,2) eq '--'
+                         && $body->[$_] =~ $boundary_re } 0 .. $#{$body};
+  }
 
-    if (!$in_body) {
+  my $last = $#{$body};
+  my $line_count = 0;
+  my $start = 0;
+  while ($start <= $last) {
+    # the part ends at the next boundary, or failing that at the last line
+    shift @boundaries  while @boundaries && $boundaries[0] < $start;
+    my $found_end_boundary = @boundaries > 0;
+    my $end = $found_end_boundary ? $boundaries[0] : $last;
+    $line_count = $last - $end;
+
+    # the part's header fields; stop at the first line which isn't one
+    my $part_msg = Mail::SpamAssassin::Message::Node->new({ normalize=>$self->{normalize}, decode_budget=>$self->{decode_budget} });
+    my $header;
+    my $in_body = 0;
+    my $i = $start;
+    for (; $i < $end; $i++) {
+      local $_ = $body->[$i];
       # s/\s+$//;   # bug 5127: don't clean this up (yet)
       if (/^[\041-\071\073-\176]+[ \t]*:/) {
         if ($header) {
@@ -930,12 +894,10 @@ sub _parse_multipart {
           $part_msg->header( $key, $value );
         }
         $header = $_;
-	next;
       }
       elsif (/^[ \t]/ && $header) {
         # $_ =~ s/^\s*//;   # bug 5127, again
         $header .= $_;
-	next;
       }
       else {
         if ($header) {
@@ -945,26 +907,99 @@ sub _parse_multipart {
         $in_body = 1;
 
 	# if there's a blank line separator, that's good.  if there isn't,
-	# it's a body line, so drop through.
+	# it's a body line, so keep it.
 	if (/^\r?$/) {
-	  next;
+	  $i++;
 	}
 	else {
           $self->{'missing_mime_head_body_separator'} = 1;
 	}
+        last;
       }
     }
 
+    # If at last line and no end boundary found, the line belongs to body
+    # TODO:
+    #  Is $self->{mime_boundary_state}->{$boundary}-- needed here?
+    #  Could "missing end boundary" be a useful rule? Mark it somewhere?
+    #  If SA processed truncated message from amavis etc, this could also
+    #  be hit legimately..
+    my $part_array;
+    if ($in_body && $i < $end) {
+      $part_array = [ @{$body}[$i .. $end-1] ];
+    }
+    if (!$found_end_boundary) {
+      push(@{$part_array}, $body->[$end]);
+    }
+
     # we run into a perl bug if the lines are astronomically long (probably
     # due to lots of regexp backtracking); so split any individual line
     # over MAX_BODY_LINE_LENGTH bytes in length.  This can wreck HTML
     # totally -- but IMHO the only reason a luser would use
     # MAX_BODY_LINE_LENGTH-byte lines is to crash filters, anyway.
-    while (length ($_) > MAX_BODY_LINE_LENGTH) {
-      push (@{$part_array}, substr($_, 0, MAX_BODY_LINE_LENGTH)."\n");
-      substr($_, 0, MAX_BODY_LINE_LENGTH) = '';
+    if ($part_array &&
+        grep { length($_) > MAX_BODY_LINE_LENGTH } @{$part_array})
+    {
+      my @split;
+      foreach (@{$part_array}) {
+        while (length ($_) > MAX_BODY_LINE_LENGTH) {
+          push (@split, substr($_, 0, MAX_BODY_LINE_LENGTH)."\n");
+          substr($_, 0, MAX_BODY_LINE_LENGTH) = '';
+        }
+        push (@split, $_);
+      }
+      $part_array = \@split;
     }
-    push ( @{$part_array}, $_ );
+
+    # per rfc 1521, the CRLF before the boundary is part of the boundary:
+    # NOTE: The CRLF preceding the encapsulation line is conceptually
+    # attached to the boundary so that it is possible to have a part
+    # that does not end with a CRLF (line break). Body parts that must
+    # be considered to end with line breaks, therefore, must have two
+    # CRLFs preceding the encapsulation line, the first of which is part
+    # of the preceding body part, and the second of which is part of the
+    # encapsulation boundary.
+    if ($found_end_boundary) {
+      if ($part_array) {
+        chomp( $part_array->[-1] );  # trim the CRLF that's part of the boundary
+        splice @{$part_array}, -1 if ( $part_array->[-1] eq '' ); # blank line for the boundary only ...
+      }
+      else {
+        # Invalid parts can have no body, so fake in a blank body
+	# in that case.
+        $part_array = [];
+      }
+    }
+
+    my($p_boundary);
+    ($part_msg->{'type'}, $p_boundary) = Mail::SpamAssassin::Util::parse_content_type($part_msg->header('content-type'));
+    $p_boundary ||= $boundary;
+    dbg("message: found part of type ".$part_msg->{'type'}.", boundary: ".(defined $p_boundary ? $p_boundary : ''));
+
+    # we've created a new node object, so add it to the queue along with the
+    # text that belongs to that part, then add the new part to the current
+    # node to create the tree.
+    push(@{$self->{'parse_queue'}}, [ $part_msg, $p_boundary, $part_array, $subparse ]);
+    $msg->add_body_part($part_msg);
+
+    # rfc 1521 says /^--boundary--$/, some MUAs may just require /^--boundary--/
+    # but this causes problems with horizontal lines when the boundary is
+    # made up of dashes as well, etc.
+    if ($found_end_boundary) {
+      if ($body->[$end] =~ /^--\Q${boundary}\E--\s*$/) {
+	# Make a note that we've seen the end boundary
+	$self->{mime_boundary_state}->{$boundary}--;
+        last;
+      }
+      elsif ($line_count && $body->[$end+1] !~ /^[\041-\071\073-\176]+:/) {
+        # if we aren't on an end boundary and there are still lines left, it
+	# means we hit a new start boundary.  therefore, the next line ought
+	# to be a mime header.  if it's not, mark it.
+	$self->{'missing_mime_headers'} = 1;
+      }
+    }
+
+    $start = $end + 1;
   }
 
   # Look for a message epilogue
@@ -1016,9 +1051,17 @@ sub _parse_normal {
 
   # If the part type is not one that we're likely to want to use, go
   # ahead and write the part data out to a temp file -- why keep sucking
-  # up RAM with something we're not going to use?
+  # up RAM with something we're not going to use?  Small parts aren't
+  # worth creating, writing and later re-reading a file for, though.
   #
+  my $size = 0;
   if ($msg->{'type'} !~ m@^(?:text/(?:plain|html)$|message\b)@) {
+    foreach (@{$body}) {
+      last if ($size += length) > MAX_PART_SIZE_IN_MEMORY;
+    }
+  }
+
+  if ($size > MAX_PART_SIZE_IN_MEMORY) {
     my($filepath, $fh);
     eval {
       ($filepath, $fh) = Mail::SpamAssassin::Util::secure_tmpfile();  1;
@@ -1047,136 +1090,54 @@ sub _parse_normal {
 
 sub get_rendered_body_text_array {
   my ($self) = @_;
-
-  if (exists $self->{text_rendered}) { return $self->{text_rendered}; }
-
-  $self->{text_rendered} = [];
-
-  # Find all parts which are leaves
-  my @parts = $self->find_parts(qr/./,1);
-  return $self->{text_rendered} unless @parts;
-
-  # the html metadata may have already been set, so let's not bother if it's
-  # already been done.
-  my $html_needs_setting = !exists $self->{metadata}->{html};
-
-  # Go through each part
-  my $text = $self->get_header ('subject') || "\n";
-  for(my $pt = 0 ; $pt <= $#parts ; $pt++ ) {
-    my $p = $parts[$pt];
-
-    # put a blank line between parts ...
-    $text .= "\n";
-
-    my($type, $rnd) = $p->rendered(); # decode this part
-    if ( defined $rnd ) {
-      # Only text/* types are rendered ...
-      $text .= $rnd;
-
-      # TVD - if there are multiple parts, what should we do?
-      # right now, just use the last one.  we may need to give some priority
-      # at some point, ie: use text/html rendered if it exists, or
-      # text/plain rendered as html otherwise.
-      if ($html_needs_setting && $type eq 'text/html') {
-        $self->{metadata}->{html} = $p->{html_results};
-      }
-    }
-  }
-
-  # whitespace handling (warning: small changes have large effects!)
-  $text =~ s/\n+\s*\n+/\f/gs;		# double newlines => form feed
-  $text =~ tr/ \t\n\r\x0b\xa0/ /s;	# whitespace => space
-  $text =~ tr/\f/\n/;			# form feeds => newline
-  
-  # warn "message: $text";
-
-  my @textary = split_into_array_of_short_lines ($text);
-  $self->{text_rendered} = \@textary;
-
-  return $self->{text_rendered};
+  return $self->_get_rendered_text_array('rendered');
 }
 
-# ---------------------------------------------------------------------------
-
-# TODO: possibly this should just replace get_rendered_body_text_array().
-# (although watch out, this one doesn't copy {html} to metadata)
 sub get_visible_rendered_body_text_array {
   my ($self) = @_;
-
-  if (exists $self->{text_visible_rendered}) {
-    return $self->{text_visible_rendered};
-  }
-
-  $self->{text_visible_rendered} = [];
-
-  # Find all parts which are leaves
-  my @parts = $self->find_parts(qr/./,1);
-  return $self->{text_visible_rendered} unless @parts;
-
-  # the html metadata may have already been set, so let's not bother if it's
-  # already been done.
-  my $html_needs_setting = !exists $self->{metadata}->{html};
-
-  # Go through each part
-  my $text = $self->get_header ('subject') || "\n";
-  for(my $pt = 0 ; $pt <= $#parts ; $pt++ ) {
-    my $p = $parts[$pt];
-
-    # put a blank line between parts ...
-    $text .= "\n";
-
-    my($type, $rnd) = $p->visible_rendered(); # decode this part
-    if ( defined $rnd ) {
-      # Only text/* types are rendered ...
-      $text .= $rnd;
-
-      # TVD - if there are multiple parts, what should we do?
-      # right now, just use the last one.  we may need to give some priority
-      # at some point, ie: use text/html rendered if it exists, or
-      # text/plain rendered as html otherwise.
-      if ($html_needs_setting && $type eq 'text/html') {
-        $self->{metadata}->{html} = $p->{html_results};
-      }
-    }
-  }
-
-  # whitespace handling (warning: small changes have large effects!)
-  $text =~ s/\n+\s*\n+/\f/gs;		# double newlines => form feed
-  $text =~ tr/ \t\n\r\x0b\xa0/ /s;	# whitespace => space
-  $text =~ tr/\f/\n/;			# form feeds => newline
-
-  my @textary = split_into_array_of_short_lines ($text);
-  $self->{text_visible_rendered} = \@textary;
-
-  return $self->{text_visible_rendered};
+  return $self->_get_rendered_text_array('visible_rendered');
 }
 
 sub get_invisible_rendered_body_text_array {
   my ($self) = @_;
+  return $self->_get_rendered_text_array('invisible_rendered');
+}
 
-  if (exists $self->{text_invisible_rendered}) {
-    return $self->{text_invisible_rendered};
-  }
+# Builds the rendered, visible or invisible text array, which get cached as
+# $self->{text_rendered}, {text_visible_rendered} and {text_invisible_rendered}.
+# Unless some part has invisible HTML text, the rendered and visible text
+# come out the same, so they're only built once and share one array: the
+# arrays are handed out to the body rules, Bayes and any plugin that asks,
+# so they must not be modified by the callers.
+sub _get_rendered_text_array {
+  my ($self, $which) = @_;
 
-  $self->{text_invisible_rendered} = [];
+  my $key = "text_$which";
+  if (exists $self->{$key}) { return $self->{$key}; }
+
+  $self->{$key} = [];
 
   # Find all parts which are leaves
   my @parts = $self->find_parts(qr/./,1);
-  return $self->{text_invisible_rendered} unless @parts;
+  return $self->{$key} unless @parts;
 
   # the html metadata may have already been set, so let's not bother if it's
   # already been done.
   my $html_needs_setting = !exists $self->{metadata}->{html};
 
+  # the invisible text doesn't start with the subject
+  my $invisible = $which eq 'invisible_rendered';
+  my $same = !$invisible;
+
   # Go through each part
-  my $text = '';
+  my $text = $invisible ? '' : ($self->get_header ('subject') || "\n");
   for(my $pt = 0 ; $pt <= $#parts ; $pt++ ) {
     my $p = $parts[$pt];
 
     # put a blank line between parts ...
-    $text .= "\n" if ( $text );
+    $text .= "\n" if ( !$invisible || $text );
 
-    my($type, $rnd) = $p->invisible_rendered(); # decode this part
+    my($type, $rnd) = $p->$which(); # decode this part
     if ( defined $rnd ) {
       # Only text/* types are rendered ...
       $text .= $rnd;
@@ -1189,6 +1150,12 @@ sub get_invisible_rendered_body_text_array {
         $self->{metadata}->{html} = $p->{html_results};
       }
     }
+
+    if ($same) {
+      my ($all, $visible) = ($p->{rendered}, $p->{visible_rendered});
+      $same = defined $all ? (defined $visible && $all eq $visible)
+                           : !defined $visible;
+    }
   }
 
   # whitespace handling (warning: small changes have large effects!)
@@ -1196,10 +1163,16 @@ sub get_invisible_rendered_body_text_array {
   $text =~ tr/ \t\n\r\x0b\xa0/ /s;	# whitespace => space
   $text =~ tr/\f/\n/;			# form feeds => newline
 
+  # warn "message: $text";
+
   my @textary = split_into_array_of_short_lines ($text);
-  $self->{text_invisible_rendered} = \@textary;
+  $self->{$key} = \@textary;
+
+  if ($same) {
+    $self->{$_} ||= $self->{$key} for qw(text_rendered text_visible_rendered);
+  }
 
-  return $self->{text_invisible_rendered};
+  return $self->{$key};
 }
 
 # ---------------------------------------------------------------------------
@@ -1231,16 +1204,22 @@ sub get_decoded_body_text_array {
 # ---------------------------------------------------------------------------
 
 sub split_into_array_of_short_lines {
-  my @result;
-  foreach my $line (split (/^/m, $_[0])) {
+  my @result = split (/^/m, $_[0]);
+
+  # most text has no overlong lines at all, so only go back over the ones
+  # that are (from the end, so the indexes stay put)
+  foreach my $i (reverse grep { length $result[$_] > MAX_BODY_LINE_LENGTH }
+                                0 .. $#result) {
+    my $line = $result[$i];
+    my @pieces;
     while (length ($line) > MAX_BODY_LINE_LENGTH) {
       # try splitting "nicely" so that we don't chop a url in half or
       # something.  if there's no space, then just split at max length.
       my $length = rindex($line, ' ', MAX_BODY_LINE_LENGTH) + 1;
       $length ||= MAX_BODY_LINE_LENGTH;
-      push (@result, substr($line, 0, $length, ''));
+      push (@pieces, substr($line, 0, $length, ''));
     }
-    push (@result, $line);
+    splice (@result, $i, 1, @pieces, $line);
   }
   @result;
 }
@@ -63,6 +63,7 @@ sub new {
   # deal with any parameters
   my($opts) = @_;
   $self->{normalize} = $opts->{'normalize'} || 0;
+  $self->{decode_budget} = $opts->{'decode_budget'}  if $opts->{'decode_budget'};
 
   bless($self,$class);
   $self;
@@ -291,6 +292,11 @@ The decoded text will be returned as a scalar string.  An optional length
 parameter can be passed in which limits how much decoded data is returned.
 If the scalar isn't needed, call with "0" as a parameter.
 
+Parts other than text/* and message/* are only decoded in full as far as
+the message's C<attachment_decode_budget> goes; once that is used up, only
+the start of any further ones is, and C<decode_truncated> is set on them.
+Asking for a limited length doesn't count against the budget.
+
 =cut
 
 sub decode {
@@ -301,25 +307,25 @@ sub decode {
     # (multipart or subparsed message, etc.)  Just return undef.
     return  if !exists $self->{'raw'};
 
-    my $raw;
-
-    # if the part is held in a temp file, read it into the scalar
-    if (ref $self->{'raw'} eq 'GLOB') {
-      my $fd = $self->{'raw'};
-      seek($fd, 0, 0)  or die "message: cannot rewind file: $!";
-
-      my($inbuf,$nread,$raw_str); $raw = '';
-      while ( $nread=sysread($fd,$inbuf,16384) ) { $raw .= $inbuf }
-      defined $nread  or die "error reading: $!";
+    my $encoding = lc $self->header('content-transfer-encoding') || '';
 
-      dbg("message: empty message read from a temp file")  if $raw eq '';
-    }
-    else {
-      # create a new scalar from the raw array in memory
-      $raw = join('', @{$self->{'raw'}});
+    # how much of an attachment the budget still allows to be decoded
+    my $budget;
+    if ($self->{'decode_budget'} && !$bytes &&
+        $self->{'type'} !~ m@^(?:text|message)\b@i)
+    {
+      $budget = ${$self->{'decode_budget'}};
+      $budget = 0  if $budget < 0;
     }
 
-    my $encoding = lc $self->header('content-transfer-encoding') || '';
+    # base64 gives 3 bytes for every 4 characters, so when only the start
+    # of a part is wanted, don't read in all of a large attachment for it;
+    # allow some extra for the line breaks
+    my $raw_length;
+    if ($encoding eq 'base64' && ($bytes || defined $budget)) {
+      $raw_length = int((($bytes || $budget+1) * 4/3 + 4) * 1.05) + 1024;
+    }
+    my ($raw, $complete) = $self->_raw_text($raw_length);
 
     if ( $encoding eq 'quoted-printable' ) {
       dbg("message: decoding quoted-printable");
@@ -332,7 +338,23 @@ sub decode {
       # if it's not defined or is 0, do the whole thing, otherwise only decode
       # a portion
       if ($bytes) {
-        return Mail::SpamAssassin::Util::base64_decode($raw, $bytes);
+        my $decoded = Mail::SpamAssassin::Util::base64_decode($raw, $bytes);
+        if (length $decoded < $bytes && !$complete) {
+          # the start of the text wasn't enough after all
+          ($raw) = $self->_raw_text();
+          $decoded = Mail::SpamAssassin::Util::base64_decode($raw, $bytes);
+        }
+        return $decoded;
+      }
+      elsif (defined $budget) {
+        # decode one byte more than the budget, to tell if it's cut short
+        $self->{'decoded'} =
+          Mail::SpamAssassin::Util::base64_decode($raw, $budget+1);
+        if (length $self->{'decoded'} <= $budget && !$complete) {
+          ($raw) = $self->_raw_text();
+          $self->{'decoded'} =
+            Mail::SpamAssassin::Util::base64_decode($raw, $budget+1);
+        }
       }
       else {
         # Generate the decoded output
@@ -353,6 +375,16 @@ sub decode {
       }
       $self->{'decoded'} = $raw;
     }
+
+    if (defined $budget) {
+      if (length $self->{'decoded'} > $budget) {
+        dbg("message: attachment decode budget used up, keeping only ".
+            "$budget bytes of a ".$self->{'type'}." part");
+        substr($self->{'decoded'}, $budget) = '';
+        $self->{'decode_truncated'} = 1;
+      }
+      ${$self->{'decode_budget'}} -= length $self->{'decoded'};
+    }
   }
 
   if ( !defined $bytes || $bytes ) {
@@ -366,6 +398,46 @@ sub decode {
   }
 }
 
+# Return the part's raw text as a scalar, and whether that's all of it; with
+# a length given, stop reading (a temp file) or joining (lines in memory)
+# once there is at least that much.
+#
+# This is not a public function.
+#
+sub _raw_text {
+  my($self, $length) = @_;
+
+  my $raw = '';
+  my $complete = 1;
+
+  # if the part is held in a temp file, read it into the scalar
+  if (ref $self->{'raw'} eq 'GLOB') {
+    my $fd = $self->{'raw'};
+    seek($fd, 0, 0)  or die "message: cannot rewind file: $!";
+
+    my($inbuf,$nread);
+    while ( $nread=sysread($fd,$inbuf,16384) ) {
+      $raw .= $inbuf;
+      if (defined $length && length $raw >= $length) { $complete = 0; last }
+    }
+    defined $nread  or die "error reading: $!";
+
+    dbg("message: empty message read from a temp file")  if $raw eq '';
+  }
+  elsif (!defined $length) {
+    # create a new scalar from the raw array in memory
+    $raw = join('', @{$self->{'raw'}});
+  }
+  else {
+    foreach (@{$self->{'raw'}}) {
+      if (length $raw >= $length) { $complete = 0; last }
+      $raw .= $_;
+    }
+  }
+
+  return ($raw, $complete);
+}
+
 # Look at a text scalar and determine whether it should be rendered
 # as text/html.
 #
@@ -478,6 +478,19 @@ sub learn_timed {
     return;
   }
 
+  if ($self->{main}->{learn_defer}) {
+    # report the decision; whether the message really gets learned is
+    # only known once learn_deferred() has run
+    $self->{auto_learn_status} = $isspam ? "spam" : "ham";
+    $self->defer_learner_write(sub { $self->_autolearn($isspam) });
+    return;
+  }
+
+  $self->_autolearn($isspam);
+}
+
+sub _autolearn {
+  my ($self, $isspam) = @_;
 
   my $timer = $self->{main}->time_method("learn");
 
@@ -516,6 +529,60 @@ sub learn_timed {
   }
 }
 
+=item $status->defer_learner_write($coderef)
+
+Queue a write to the learner's databases, to be run by C<learn_deferred()>
+instead of while the message is being checked.  Used by learner plugins
+when the C<defer_learning> learner option is set.
+
+=cut
+
+sub defer_learner_write {
+  my ($self, $ref) = @_;
+  push @{$self->{deferred_learner_writes}}, $ref;
+}
+
+=item $status->learn_deferred()
+
+Run the learner database writes deferred while the message was checked,
+such as Bayes token atime updates and auto-learning, if the C<defer_learning>
+learner option was set (see C<Mail::SpamAssassin::init_learner()>).  This is
+meant to be called once the result of the check has been passed on, so
+that the database writes don't add to the latency of a check.  Like
+C<learn()>, it stops at the message's master deadline, if there is one.
+
+=cut
+
+sub learn_deferred {
+  my ($self) = @_;
+  my $writes = delete $self->{deferred_learner_writes};
+  return if !$writes;
+
+  my $master_deadline = $self->{master_deadline};
+  if (!$master_deadline) {
+    $self->learn_deferred_timed($writes);
+  } else {
+    my $t = Mail::SpamAssassin::Timeout->new({ deadline => $master_deadline });
+    my $err = $t->run(sub { $self->learn_deferred_timed($writes) });
+    if (time > $master_deadline && !$self->{deadline_exceeded}) {
+      info("learn: exceeded time limit in deferred learner writes");
+      $self->{deadline_exceeded} = 1;
+    }
+  }
+}
+
+sub learn_deferred_timed {
+  my ($self, $writes) = @_;
+
+  my $timer = $self->{main}->time_method("learn_deferred");
+  foreach my $ref (@{$writes}) {
+    eval { $ref->(); 1; } or do {
+      my $eval_stat = $@ ne '' ? $@ : "errno=$!";  chomp $eval_stat;
+      dbg("learn: deferred learner write failed: $eval_stat");
+    };
+  }
+}
+
 =item $score = $status->get_autolearn_points()
 
 Return the message's score as computed for auto-learning.  Certain tests are
@@ -857,11 +924,11 @@ sub get_content_preview {
 
   my $str = '';
   my $ary = $self->get_decoded_stripped_body_text_array();
-  shift @{$ary};                # drop the subject line
+  my $i = 1;                    # skip the subject line
 
   my $numlines = 3;
-  while (length ($str) < 200 && @{$ary} && $numlines-- > 0) {
-    $str .= shift @{$ary};
+  while (length ($str) < 200 && $i < @{$ary} && $numlines-- > 0) {
+    $str .= $ary->[$i++];
   }
   undef $ary;
   chomp ($str); $str .= " [...]\n";
@@ -1670,11 +1737,9 @@ sub extract_message_metadata {
   $self->set_tag('RELAYSEXTERNAL',  $self->{relays_external_str});
   $self->set_tag('LANGUAGES', $self->{msg}->get_metadata("X-Languages"));
 
-  # This should happen before we get called, but just in case.
-  if (!defined $self->{msg}->{metadata}->{html}) {
-    $self->get_decoded_stripped_body_text_array();
-  }
-  $self->{html} = $self->{msg}->{metadata}->{html};
+  # the body is not rendered here: that is left until a rule or plugin
+  # first needs it, see get_decoded_stripped_body_text_array(), which is
+  # also when $self->{html} is set
 
   # allow plugins to add more metadata, read the stuff that's there, etc.
   $self->{main}->call_plugins ("parsed_metadata", { permsgstatus => $self });
@@ -1709,10 +1774,23 @@ It is returned as an array of strings, with each string representing one
 'paragraph'.  Paragraphs, in plain-text mails, are double-newline-separated
 blocks of multi-line text.
 
+The body is only rendered the first time this is called.  The results of
+parsing any HTML part are then available in C<$status-E<gt>{html}>.
+
+The same array is handed to every caller (and may be shared with the
+visible rendered text used by Bayes), so it must not be modified; copy any
+line that needs changing.
+
 =cut
 
 sub get_decoded_stripped_body_text_array {
-  return $_[0]->{msg}->get_rendered_body_text_array();
+  my ($self) = @_;
+  my $text = $self->{msg}->get_rendered_body_text_array();
+  if (!$self->{html_set}) {
+    $self->{html} = $self->{msg}->{metadata}->{html};
+    $self->{html_set} = 1;
+  }
+  return $text;
 }
 
 ###########################################################################
@@ -2392,6 +2470,85 @@ sub ensure_rules_are_complete {
 
 ###########################################################################
 
+# Is a sub-rule still worth running?  Not if every meta rule using it is
+# already decided, or is itself a sub-rule which is no longer needed.
+# Only called for the rules compile_meta_dag() marked as skippable.
+sub subrule_needed {
+  my ($self, $rulename, $memo) = @_;
+  my $consumers = $self->{conf}->{meta_dag}->{consumers};
+
+  $memo ||= { };
+  return $memo->{$rulename} if exists $memo->{$rulename};
+  $memo->{$rulename} = 1;   # in case of a loop, play safe
+
+  my $needed = 0;
+  foreach my $meta (@{$consumers->{$rulename}}) {
+    next if defined $self->meta_rule_state($meta);
+    if ($meta !~ /^__/ || !$consumers->{$meta} ||
+        $self->subrule_needed($meta, $memo))
+    {
+      $needed = 1;
+      last;
+    }
+  }
+
+  dbg("rules: skipping $rulename, no meta rule depending on it can change")
+    if !$needed;
+  return $memo->{$rulename} = $needed;
+}
+
+# The outcome of a meta rule as far as it is known so far: true or false,
+# or undef if it depends on rules whose results are not in yet.
+sub meta_rule_state {
+  my ($self, $rulename, $depth) = @_;
+
+  return 1 if $self->{tests_already_hit}->{$rulename};
+  return 0 if $self->rule_has_run($rulename);
+
+  my $program = $self->{conf}->{meta_dag}->{program}->{$rulename};
+  return if !$program || ($depth||0) > 20;
+
+  my @stack;
+  foreach my $op (@{$program}) {
+    if ($op eq '!') {
+      my $v = pop @stack;
+      push(@stack, defined $v ? ($v ? 0 : 1) : undef);
+    }
+    elsif ($op eq '&&') {
+      my ($x, $y) = splice(@stack, -2);
+      push(@stack, (defined $x && !$x) || (defined $y && !$y) ? 0
+                 : (defined $x && defined $y) ? 1 : undef);
+    }
+    elsif ($op eq '||') {
+      my ($x, $y) = splice(@stack, -2);
+      push(@stack, ($x || $y) ? 1
+                 : (defined $x && defined $y) ? 0 : undef);
+    }
+    elsif ($self->{tests_already_hit}->{$op}) {
+      push(@stack, 1);
+    }
+    elsif (($self->{conf}->{meta_dag}->{ruletype}->{$op}||'') eq 'meta') {
+      push(@stack, $self->meta_rule_state($op, ($depth||0) + 1));
+    }
+    else {
+      push(@stack, $self->rule_has_run($op) ? 0 : undef);
+    }
+  }
+  return $stack[0];
+}
+
+# true once a header, body, rawbody, uri, full or meta rule has had its
+# turn, so that if it has not hit by now, it will not
+sub rule_has_run {
+  my ($self, $rulename) = @_;
+  my $type = $self->{conf}->{meta_dag}->{ruletype}->{$rulename};
+  return 0 if !defined $type;
+  my $done = $self->{tests_done_at_priority}->{$type};
+  return defined $done && $done >= ($self->{conf}->{priority}->{$rulename}||0);
+}
+
+###########################################################################
+
 # use a separate sub here, for brevity
 # called out of generated eval
 sub handle_eval_rule_errors {
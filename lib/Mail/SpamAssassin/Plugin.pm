@@ -429,6 +429,11 @@ network events triggered in a C<parse_metadata> method, for example.
 
 The C<Mail::SpamAssassin::PerMsgStatus> context object for this scan.
 
+=item priority
+
+When called at the end of a priority's worth of rules in the main check
+loop, the priority which has just been run.  Not present otherwise.
+
 =back
 
 =item $plugin->check_post_dnsbl ( { options ... } )
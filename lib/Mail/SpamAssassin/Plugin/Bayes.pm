@@ -52,6 +52,7 @@ BEGIN {
   eval { require Digest::SHA; import Digest::SHA qw(sha1 sha1_hex); 1 }
   or do { require Digest::SHA1; import Digest::SHA1 qw(sha1 sha1_hex) }
 }
+use Digest::MD5 qw(md5);
 
 use Mail::SpamAssassin;
 use Mail::SpamAssassin::Plugin;
@@ -69,6 +70,7 @@ use vars qw{
   $IGNORED_HDRS
   $MARK_PRESENCE_ONLY_HDRS
   %HEADER_NAME_COMPRESSION
+  %STOPLIST
   $OPPORTUNISTIC_LOCK_VALID
 };
 
@@ -202,6 +204,21 @@ use constant ADD_INVIZ_TOKENS_NO_PREFIX => 0;
   'x-spam-relays-untrusted' => '*RU',
 );
 
+# Gray-area words which aren't worth recording as tokens; matched
+# case-insensitively against whole tokens in _tokenize_line().
+# See http://wiki.apache.org/spamassassin/BayesStopList for more info.
+%STOPLIST = map { $_ => 1 } qw(
+  able all already and any are because both can come each email even
+  few first for from give has have http information into it's just know
+  like long look made mail mailing mailto make many more most much need
+  not now number off one only out own people place right same see such
+  that the this through time using web where why with without work world
+  year years you you're your
+);
+
+# The longest word in %STOPLIST, so longer tokens can skip the lookup.
+use constant MAX_STOPLIST_WORD_LENGTH => 11;
+
 # How many seconds should the opportunistic_expire lock be valid?
 $OPPORTUNISTIC_LOCK_VALID = 300;
 
@@ -701,7 +718,12 @@ sub scan {
 
   my $tokensdata;
   { my $timer = $self->{main}->time_method('b_tok_get_all');
-    $tokensdata = $self->{store}->tok_get_all(keys %{$msgtokens});
+    if ($self->{conf}->{bayes_token_cache_size} > 0) {
+      $tokensdata = $self->_tok_get_all_cached($permsgstatus, $ns, $nn,
+                                               keys %{$msgtokens});
+    } else {
+      $tokensdata = $self->{store}->tok_get_all(keys %{$msgtokens});
+    }
   }
 
   my $timer_compute_prob = $self->{main}->time_method('b_comp_prob');
@@ -709,9 +731,13 @@ sub scan {
   my $probabilities_ref =
     $self->_compute_prob_for_all_tokens($tokensdata, $ns, $nn);
 
-  my %pw;
+  # Note the strength of each token as we go; tokens too close to the
+  # middle ground will never be used, so they need not be sorted below.
+  my (%pw, @strong_toks);
+  my $min_strength = $Mail::SpamAssassin::Bayes::Combine::MIN_PROB_STRENGTH;
+  my $i = 0;
   foreach my $tokendata (@{$tokensdata}) {
-    my $prob = shift(@$probabilities_ref);
+    my $prob = $probabilities_ref->[$i++];
     next unless defined $prob;
     my ($token, $tok_spam, $tok_ham, $atime) = @{$tokendata};
     $pw{$token} = {
@@ -720,19 +746,20 @@ sub scan {
       ham_count => $tok_ham,
       atime => $atime
     };
+    my $strength = abs($prob - 0.5);
+    push(@strong_toks, [$token, $strength])  if $strength >= $min_strength;
   }
 
-  my @pw_keys = keys %pw;
+  my $tcount_learned = scalar keys %pw;
 
   # If none of the tokens were found in the DB, we're going to skip
   # this message...
-  if (!@pw_keys) {
+  if (!$tcount_learned) {
     dbg("bayes: cannot use bayes on this message; none of the tokens were found in the database");
     goto skip;
   }
 
   my $tcount_total = keys %{$msgtokens};
-  my $tcount_learned = scalar @pw_keys;
 
   # Figure out the message receive time (used as atime below)
   # If the message atime comes back as being in the future, something's
@@ -746,21 +773,18 @@ sub scan {
   my $tinfo_spammy = $permsgstatus->{bayes_token_info_spammy} = [];
   my $tinfo_hammy = $permsgstatus->{bayes_token_info_hammy} = [];
 
-  my %tok_strength = map( ($_, abs($pw{$_}->{prob} - 0.5)), @pw_keys);
   my $log_each_token = (would_log('dbg', 'bayes') > 1);
 
   # now take the most significant tokens and calculate probs using
   # Robinson's formula.
 
-  @pw_keys = sort { $tok_strength{$b} <=> $tok_strength{$a} } @pw_keys;
+  my @pw_keys = map { $_->[0] }
+                  sort { $b->[1] <=> $a->[1] } @strong_toks;
 
   if (@pw_keys > N_SIGNIFICANT_TOKENS) { $#pw_keys = N_SIGNIFICANT_TOKENS - 1 }
 
   my @sorted;
   foreach my $tok (@pw_keys) {
-    next if $tok_strength{$tok} <
-                $Mail::SpamAssassin::Bayes::Combine::MIN_PROB_STRENGTH;
-
     my $pw_tok = $pw{$tok};
     my $pw_prob = $pw_tok->{prob};
 
@@ -805,7 +829,15 @@ sub scan {
   # tokens and a score was returned
   # we don't really care about the return value here
 
-  { my $timer = $self->{main}->time_method('b_tok_touch_all');
+  if ($self->{main}->{learn_defer}) {
+    # the caller will run it once the result is out, see
+    # PerMsgStatus::learn_deferred()
+    $permsgstatus->defer_learner_write(sub {
+      $self->_deferred_tok_touch_all(\@touch_tokens, $msgatime);
+    });
+  }
+  else {
+    my $timer = $self->{main}->time_method('b_tok_touch_all');
     $self->{store}->tok_touch_all(\@touch_tokens, $msgatime);
   }
 
@@ -900,6 +932,95 @@ skip:
 
 ###########################################################################
 
+# tok_touch_all() for a scan which has already finished, and so has
+# let go of the db
+sub _deferred_tok_touch_all {
+  my ($self, $tokens, $atime) = @_;
+
+  return unless $self->{store}->tie_db_readonly();
+
+  { my $timer = $self->{main}->time_method('b_tok_touch_all');
+    $self->{store}->tok_touch_all($tokens, $atime);
+  }
+  $self->{store}->cleanup();
+
+  if (!$self->{main}->{learn_caller_will_untie}) {
+    $self->{store}->untie_db();
+  }
+}
+
+###########################################################################
+
+# Fetch token counts like BayesStore::tok_get_all(), but through a
+# per-process cache of recently used tokens, including those which aren't
+# in the db.  The cache is kept in two generations: once the current one
+# holds half of bayes_token_cache_size tokens it becomes the old one, and
+# the previous old one is dropped.  Tokens found in the old generation are
+# moved back to the current one, so frequently seen tokens stay cached.
+sub _tok_get_all_cached {
+  my ($self, $permsgstatus, $ns, $nn, @tokens) = @_;
+
+  my $conf = $self->{conf};
+  my $now = time;
+  my $owner = join("\000", map { defined $_ ? $_ : '' }
+                  $self->{main}->{username}, $conf->{bayes_path},
+                  $conf->{bayes_sql_override_username});
+
+  # counts learned into the db change the probabilities of every token,
+  # so start afresh
+  my $cache = $self->{token_cache};
+  if (!$cache || $cache->{owner} ne $owner ||
+      $cache->{nspam} != $ns || $cache->{nham} != $nn)
+  {
+    dbg("bayes: token cache reset");
+    $cache = $self->{token_cache} = {
+      owner => $owner, nspam => $ns, nham => $nn, cur => {}, old => {},
+    };
+  }
+
+  my $ttl = $conf->{bayes_token_cache_ttl};
+  my ($cur, $old) = ($cache->{cur}, $cache->{old});
+  my (@tokensdata, @missing);
+  foreach my $token (@tokens) {
+    my $entry = $cur->{$token};
+    if (!$entry && ($entry = delete $old->{$token})) {
+      $cur->{$token} = $entry;
+    }
+    if (!$entry || $now - $entry->[3] > $ttl) {
+      push(@missing, $token);
+    }
+    elsif ($entry->[0] || $entry->[1]) {
+      push(@tokensdata, [$token, @{$entry}[0..2]]);
+    }
+  }
+
+  if (@missing) {
+    my %fetched;
+    foreach my $tokendata (@{$self->{store}->tok_get_all(@missing)}) {
+      my ($token, $tok_spam, $tok_ham, $atime) = @{$tokendata};
+      $fetched{$token} = [$tok_spam, $tok_ham, $atime, $now];
+      push(@tokensdata, $tokendata);
+    }
+    foreach my $token (@missing) {
+      $cur->{$token} = $fetched{$token} || [0, 0, 0, $now];
+    }
+  }
+
+  if (keys %{$cur} > $conf->{bayes_token_cache_size} / 2) {
+    $cache->{old} = $cur;
+    $cache->{cur} = {};
+  }
+
+  my $hits = @tokens - @missing;
+  dbg("bayes: token cache hits %d of %d tokens", $hits, scalar @tokens);
+  my $lookups = scalar @tokens;
+  $permsgstatus->set_spamd_result_item(sub { "bayes_cache=$hits/$lookups" });
+
+  return \@tokensdata;
+}
+
+###########################################################################
+
 # Plugin hook.
 sub learner_dump_database {
   my ($self, $params) = @_;
@@ -1073,11 +1194,14 @@ sub tokenize {
   }
 
   # Go ahead and uniq the array, skip null tokens (can happen sometimes)
-  # generate an SHA1 hash and take the lower 40 bits as our token
-  my %tokens;
+  # generate a hash (SHA1 unless the db was created with bayes_token_hash
+  # md5) and take the lower 40 bits as our token.
+  # Most tokens recur within a message, so drop repeats before hashing.
+  my $hash = $self->{store}->token_hash() eq 'md5' ? \&md5 : \&sha1;
+  my(%seen, %tokens);
   foreach my $token (@tokens) {
-    next unless length($token); # skip 0 length tokens
-    $tokens{substr(sha1($token), -5)} = $token;
+    next if !length($token) || $seen{$token}++; # skip 0 length tokens
+    $tokens{substr($hash->($token), -5)} = $token;
   }
 
   # return the keys == tokens ...
@@ -1112,6 +1236,7 @@ sub _tokenize_line {
   }
 
   my $magic_re = $self->{store}->get_magic_re();
+  my $in_body = ($region == 1 || $region == 2);
 
   foreach my $token (split) {
     $token =~ s/^[-'"\.,]+//;        # trim non-alphanum chars at start or end
@@ -1131,11 +1256,11 @@ sub _tokenize_line {
     # area, and it just slows us down to record them.
     # See http://wiki.apache.org/spamassassin/BayesStopList for more info.
     #
-    next if $len < 3 ||
-	($token =~ /^(?:a(?:ble|l(?:ready|l)|n[dy]|re)|b(?:ecause|oth)|c(?:an|ome)|e(?:ach|mail|ven)|f(?:ew|irst|or|rom)|give|h(?:a(?:ve|s)|ttp)|i(?:n(?:formation|to)|t\'s)|just|know|l(?:ike|o(?:ng|ok))|m(?:a(?:de|il(?:(?:ing|to))?|ke|ny)|o(?:re|st)|uch)|n(?:eed|o[tw]|umber)|o(?:ff|n(?:ly|e)|ut|wn)|p(?:eople|lace)|right|s(?:ame|ee|uch)|t(?:h(?:at|is|rough|e)|ime)|using|w(?:eb|h(?:ere|y)|ith(?:out)?|or(?:ld|k))|y(?:ears?|ou(?:(?:\'re|r))?))$/i);
+    next if $len < 3 || ($len <= MAX_STOPLIST_WORD_LENGTH &&
+                           exists $STOPLIST{lc $token});
 
     # are we in the body?  If so, apply some body-specific breakouts
-    if ($region == 1 || $region == 2) {
+    if ($in_body) {
       if (CHEW_BODY_MAILADDRS && $token =~ /\S\@\S/i) {
 	push (@rettokens, $self->_tokenize_mail_addrs ($token));
       }
@@ -1175,20 +1300,21 @@ sub _tokenize_line {
     }
 
     # decompose tokens?  do this after shortening long tokens
-    if ($region == 1 || $region == 2) {
+    if ($in_body) {
       if (DECOMPOSE_BODY_TOKENS) {
-        if ($token =~ /[^\w:\*]/) {
+        my $has_punct = ($token =~ /[^\w:\*]/);
+        if ($has_punct) {
           my $decompd = $token;                        # "Foo!"
-          $decompd =~ s/[^\w:\*]//gs;
+          $decompd =~ tr/A-Za-z0-9_:*//cd;
           push (@rettokens, $tokprefix.$decompd);      # "Foo"
         }
 
-        if ($token =~ /[A-Z]/) {
-          my $decompd = $token; $decompd = lc $decompd;
+        if ($token =~ tr/A-Z//) {
+          my $decompd = lc $token;
           push (@rettokens, $tokprefix.$decompd);      # "foo!"
 
-          if ($token =~ /[^\w:\*]/) {
-            $decompd =~ s/[^\w:\*]//gs;
+          if ($has_punct) {
+            $decompd =~ tr/A-Za-z0-9_:*//cd;
             push (@rettokens, $tokprefix.$decompd);    # "foo"
           }
         }
@@ -1423,6 +1549,9 @@ sub _compute_prob_for_all_tokens {
     $threshold = 2;
   }
 
+  my $fw_s_dot_x = $Mail::SpamAssassin::Bayes::Combine::FW_S_DOT_X;
+  my $fw_s_constant = $Mail::SpamAssassin::Bayes::Combine::FW_S_CONSTANT;
+
   foreach my $tokendata (@{$tokensdata}) {
     my $s = $tokendata->[1];  # spam count
     my $n = $tokendata->[2];  # ham count
@@ -1442,10 +1571,7 @@ sub _compute_prob_for_all_tokens {
         # use Robinson's f(x) equation for low-n tokens, instead of just
         # ignoring them
         my $robn = $s + $n;
-        $prob =
-          ($Mail::SpamAssassin::Bayes::Combine::FW_S_DOT_X + ($robn * $prob))
-                               /
-          ($Mail::SpamAssassin::Bayes::Combine::FW_S_CONSTANT + $robn);
+        $prob = ($fw_s_dot_x + ($robn * $prob)) / ($fw_s_constant + $robn);
       }
     }
 
@@ -23,6 +23,11 @@ Mail::SpamAssassin::Plugin::BodyRuleBaseExtractor - extract "bases" from body ru
 This is a plugin to extract "base" strings from SpamAssassin 'body' rules,
 suitable for use in Rule2XSBody rules or other parallel matching algorithms.
 
+Bases are also extracted from 'rawbody' and 'uri' rules, and from 'header'
+rules of the simple C<Name =~ /pattern/> form; header rules are grouped
+into one set per header name, since each set is scanned against a single
+header's value.
+
 =cut
 
 package Mail::SpamAssassin::Plugin::BodyRuleBaseExtractor;
@@ -31,6 +36,7 @@ use Mail::SpamAssassin::Plugin;
 use Mail::SpamAssassin::Logger;
 use Mail::SpamAssassin::Util qw(untaint_var);
 use Mail::SpamAssassin::Util::Progress;
+use Mail::SpamAssassin::Plugin::OneLineBodyRuleType;
 
 use Errno qw(ENOENT EACCES EEXIST);
 use Data::Dumper;
@@ -101,14 +107,40 @@ sub extract_bases {
         info("base extraction starting.  this can take a while...");
 
   $self->extract_set($conf, $conf->{body_tests}, 'body');
+  $self->extract_set($conf, $conf->{rawbody_tests}, 'rawbody');
+  $self->extract_set($conf, $conf->{uri_tests}, 'uri');
+  $self->extract_head_set($conf, $conf->{head_tests});
 }
 
 sub extract_set {
   my ($self, $conf, $test_set, $ruletype) = @_;
 
   foreach my $pri (keys %{$test_set}) {
-    my $nicepri = $pri; $nicepri =~ s/-/neg/g;
-    $self->extract_set_pri($conf, $test_set->{$pri}, $ruletype.'_'.$nicepri);
+    $self->extract_set_pri($conf, $test_set->{$pri},
+        Mail::SpamAssassin::Plugin::OneLineBodyRuleType::zoom_set_name(
+                                                        $ruletype, $pri));
+  }
+}
+
+sub extract_head_set {
+  my ($self, $conf, $test_set) = @_;
+
+  foreach my $pri (keys %{$test_set}) {
+    # group the patterns by the header they are matched against
+    my %by_header;
+    foreach my $name (keys %{$test_set->{$pri}}) {
+      my ($hdrname, $pat) =
+        Mail::SpamAssassin::Plugin::OneLineBodyRuleType::split_head_rule(
+                                            $test_set->{$pri}->{$name});
+      next if !defined $hdrname;
+      $by_header{$hdrname}->{$name} = $pat;
+    }
+
+    foreach my $hdrname (keys %by_header) {
+      $self->extract_set_pri($conf, $by_header{$hdrname},
+          Mail::SpamAssassin::Plugin::OneLineBodyRuleType::zoom_set_name(
+                                                'head', $pri, $hdrname));
+    }
   }
 }
 
@@ -19,6 +19,12 @@ use warnings;
 use re 'taint';
 
 use Time::HiRes qw(time);
+use File::Spec;
+
+BEGIN {
+  eval { require Digest::SHA; import Digest::SHA qw(sha1_hex); 1 }
+  or do { require Digest::SHA1; import Digest::SHA1 qw(sha1_hex) }
+}
 
 use Mail::SpamAssassin::Plugin;
 use Mail::SpamAssassin::Logger;
@@ -26,6 +32,10 @@ use Mail::SpamAssassin::Util qw(untaint_var);
 use Mail::SpamAssassin::Timeout;
 use Mail::SpamAssassin::Constants qw(:sa);
 
+# header rules with a string that must be present are only scanned for
+# together when there are at least this many on a header
+use constant HEAD_PREFILTER_MIN_RULES => 2;
+
 use vars qw(@ISA @TEMPORARY_METHODS);
 @ISA = qw(Mail::SpamAssassin::Plugin);
 
@@ -82,15 +92,14 @@ sub check_main {
   $self->run_rbl_eval_tests($pms);
   my $needs_dnsbl_harvest_p = 1; # harvest needs to be run
 
-  my $decoded = $pms->get_decoded_stripped_body_text_array();
-  my $bodytext = $pms->get_decoded_body_text_array();
-  my $fulltext = $pms->{msg}->get_pristine();
+  # the texts the rules are run on are only extracted from the message
+  # once a priority with rules of a type which needs them is reached, so
+  # that a message decided by its header rules is never decoded or rendered
+  my ($decoded, $bodytext, $fulltext, $uris);
   my $master_deadline = $pms->{master_deadline};
   dbg("check: check_main, time limit in %.3f s",
       $master_deadline - time)  if $master_deadline;
 
-  my @uris = $pms->get_uri_list();
-
   foreach my $priority (sort { $a <=> $b } keys %{$pms->{conf}->{priorities}}) {
     # no need to run if there are no priorities at this level.  This can
     # happen in Conf.pm when we switch a rule from one priority to another
@@ -132,6 +141,21 @@ sub check_main {
     }
 
     $pms->harvest_completed_queries();
+
+    my $needed = $self->texts_needed_at_priority($pms, $priority);
+    if ($needed->{decoded} && !$decoded) {
+      $decoded = $pms->get_decoded_stripped_body_text_array();
+    }
+    if ($needed->{bodytext} && !$bodytext) {
+      $bodytext = $pms->get_decoded_body_text_array();
+    }
+    if ($needed->{fulltext} && !defined $fulltext) {
+      $fulltext = $pms->{msg}->get_pristine();
+    }
+    if ($needed->{uris} && !$uris) {
+      $uris = [ $pms->get_uri_list() ];
+    }
+
     # allow other, plugin-defined rule types to be called here
     $self->{main}->call_plugins ("check_rules_at_priority",
         { permsgstatus => $pms, priority => $priority, checkobj => $self });
@@ -145,23 +169,23 @@ sub check_main {
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
 
-    $self->do_body_tests($pms, $priority, $decoded);
+    $self->do_body_tests($pms, $priority, $decoded || []);
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
 
-    $self->do_uri_tests($pms, $priority, @uris);
+    $self->do_uri_tests($pms, $priority, @{$uris || []});
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
 
-    $self->do_body_eval_tests($pms, $priority, $decoded);
+    $self->do_body_eval_tests($pms, $priority, $decoded || []);
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
   
-    $self->do_rawbody_tests($pms, $priority, $bodytext);
+    $self->do_rawbody_tests($pms, $priority, $bodytext || []);
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
 
-    $self->do_rawbody_eval_tests($pms, $priority, $bodytext);
+    $self->do_rawbody_eval_tests($pms, $priority, $bodytext || []);
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
   
@@ -179,7 +203,8 @@ sub check_main {
 
     # we may need to call this more often than once through the loop, but
     # it needs to be done at least once, either at the beginning or the end.
-    $self->{main}->call_plugins ("check_tick", { permsgstatus => $pms });
+    $self->{main}->call_plugins ("check_tick",
+        { permsgstatus => $pms, priority => $priority });
     $pms->harvest_completed_queries();
     last if $pms->{deadline_exceeded};
   }
@@ -210,6 +235,7 @@ sub check_main {
   undef $decoded;
   undef $bodytext;
   undef $fulltext;
+  undef $uris;
 
   if ($pms->{deadline_exceeded}) {
   # dbg("check: exceeded time limit, skipping auto-learning");
@@ -237,6 +263,36 @@ sub check_main {
   return 1;
 }
 
+# which of the texts extracted from the message the rules at a priority
+# are run on; header and meta rules need none of them, and plugins which
+# run their own rule types fetch what they need themselves
+sub texts_needed_at_priority {
+  my ($self, $pms, $priority) = @_;
+  my $types = $pms->{conf}->{test_types_at_priority}->{$priority};
+  my %needed;
+  foreach my $type (keys %{$types || { }}) {
+    if ($type == $Mail::SpamAssassin::Conf::TYPE_BODY_TESTS ||
+        $type == $Mail::SpamAssassin::Conf::TYPE_BODY_EVALS)
+    {
+      $needed{decoded} = 1;
+    }
+    elsif ($type == $Mail::SpamAssassin::Conf::TYPE_URI_TESTS) {
+      $needed{uris} = 1;
+    }
+    elsif ($type == $Mail::SpamAssassin::Conf::TYPE_RAWBODY_TESTS ||
+           $type == $Mail::SpamAssassin::Conf::TYPE_RAWBODY_EVALS)
+    {
+      $needed{bodytext} = 1;
+    }
+    elsif ($type == $Mail::SpamAssassin::Conf::TYPE_FULL_TESTS ||
+           $type == $Mail::SpamAssassin::Conf::TYPE_FULL_EVALS)
+    {
+      $needed{fulltext} = 1;
+    }
+  }
+  return \%needed;
+}
+
 sub finish_tests {
   my ($self, $params) = @_;
 
@@ -313,6 +369,16 @@ sub run_generic_tests {
 
   if (!defined &{$methodname} || $doing_user_rules) {
 
+    # rules which have been compiled by an earlier process may be cached
+    my $cache = !$doing_user_rules &&
+        $self->rule_code_cache($pms, $ruletype, $priority, $opts{testhash});
+    if ($cache && $self->load_rule_code($pms, $cache)) {
+      $self->free_ruleset_source($pms, $ruletype, $priority);
+      goto run_compiled_method;
+    }
+    my $num_temporary_methods = scalar @TEMPORARY_METHODS;
+    my $rule_errors = $pms->{rule_errors} || 0;
+
     # use %nopts for named parameter-passing; it's more friendly
     # to future-proof subclassing, since new parameters can be added without
     # breaking third-party subclassed implementations of this plugin.
@@ -330,6 +396,7 @@ sub run_generic_tests {
     $self->{evalstr_chunk_prefix} = []; # stack (array) of source code sections
     $self->{evalstr} = ''; $self->{evalstr_l} = 0;
     $self->{evalstr2} = '';
+    $self->{evalstr_compiled} = $cache ? [] : undef;
     $self->begin_evalstr_chunk($pms);
 
     $self->push_evalstr_prefix($pms, '
@@ -377,6 +444,7 @@ EOT
   }
 EOT
 
+    my $compiled = delete $self->{evalstr_compiled};
     delete $self->{evalstr};   # free up some RAM before we eval()
     delete $self->{evalstr2};
     delete $self->{evalstr_methodname};
@@ -399,9 +467,16 @@ EOT
       return;
     }
     dbg("rules: compiled $ruletype tests");
+
+    if ($cache && ($pms->{rule_errors} || 0) == $rule_errors) {
+      my @methods = @TEMPORARY_METHODS[$num_temporary_methods .. $#TEMPORARY_METHODS];
+      $self->save_rule_code($pms, $cache,
+                  "push(\@TEMPORARY_METHODS, qw(@methods));\n" .
+                  join('', @{$compiled}, $evalstr));
+    }
   }
 
-#run_compiled_method:
+run_compiled_method:
 # dbg("rules: run_generic_tests - calling %s", $methodname);
   my $t = Mail::SpamAssassin::Timeout->new({ deadline => $master_deadline });
   my $err = $t->run(sub {
@@ -412,6 +487,11 @@ EOT
     info("check: exceeded time limit in $methodname, skipping further tests");
     $pms->{deadline_exceeded} = 1;
   }
+  else {
+    # rules of this type and priority which have not hit by now won't;
+    # see PerMsgStatus::rule_has_run()
+    $pms->{tests_done_at_priority}->{$ruletype} = $priority;
+  }
 }
 
 sub begin_evalstr_chunk {
@@ -462,6 +542,8 @@ sub flush_evalstr {
     $pms->{rule_errors}++;
   } else {
     push(@{$self->{evalstr_chunk_methodnames}}, $chunk_methodname);
+    push(@{$self->{evalstr_compiled}}, $self->{evalstr})
+      if $self->{evalstr_compiled};
   }
   $self->{evalstr} = '';  $self->{evalstr_l} = 0;
   $self->begin_evalstr_chunk($pms);
@@ -510,12 +592,163 @@ sub add_evalstr2 {
   $self->{evalstr2} .= $str;
 }
 
+# with skip_unneeded_subrules, the extra condition for running a rule
+sub subrule_needed_code {
+  my ($self, $pms, $rulename) = @_;
+  my $dag = $pms->{conf}->{meta_dag};
+  return '' unless $dag && $dag->{skippable}->{$rulename};
+  return ' && $self->subrule_needed(q{'.$rulename.'})';
+}
+
+# with the profile_rules option, the code to time each rule; the times
+# are kept in $main->{rule_profile}, see Mail::SpamAssassin::save_rule_profile
+sub rule_profile_start_code {
+  my ($self) = @_;
+  return '' unless $self->{main}->{profile_rules};
+  return '
+    my $profile_t0 = Time::HiRes::time();
+  ';
+}
+
+sub rule_profile_end_code {
+  my ($self, $rulename) = @_;
+  return '' unless $self->{main}->{profile_rules};
+  return '
+    { my $p = $self->{main}->{rule_profile}->{q{'.$rulename.'}} ||= [0,0,0];
+      $p->[0]++;
+      $p->[1] += Time::HiRes::time() - $profile_t0;
+      $p->[2]++ if $self->{tests_already_hit}->{q{'.$rulename.'}};
+    }
+  ';
+}
+
 sub add_temporary_method {
   my ($self, $methodname, $methodbody) = @_;
   $self->add_evalstr2 (' sub '.$methodname.' { '.$methodbody.' } ');
   push (@TEMPORARY_METHODS, $methodname);
 }
 
+# with rule_code_cache_dir, the file which caches the code for a set of
+# rules, and the hash of everything that code is generated from
+sub rule_code_cache {
+  my ($self, $pms, $ruletype, $priority, $testhash) = @_;
+  my $conf = $pms->{conf};
+  my $main = $self->{main};
+
+  my $dir = $conf->{rule_code_cache_dir};
+  return if !defined $dir || $dir eq '';
+  return if $conf->{allow_user_rules} || $main->{lint_rules};
+  # debug code is compiled into the rules, see hit_rule_plugin_code()
+  return if would_log('dbg') || exists $pms->{should_log_rule_hits};
+
+  my $rules = $testhash->{$priority} || { };
+  my $tflags = $conf->{tflags};
+  my $dag = $conf->{meta_dag};
+
+  my @key = (
+    Mail::SpamAssassin::Version(), $], $ruletype, $priority,
+    (stat($INC{'Mail/SpamAssassin/Plugin/Check.pm'}))[9],
+    map { $_ ? 1 : 0 } $main->{use_rule_subs}, $main->{profile_rules},
+        $pms->{save_pattern_hits}, $main->have_plugin("start_rules"),
+        $main->have_plugin("ran_rule")
+  );
+  foreach my $rulename (sort keys %{$rules}) {
+    push(@key, $rulename, $rules->{$rulename}, $tflags->{$rulename},
+         $conf->{source_file}->{$rulename},
+         $dag && $dag->{skippable}->{$rulename});
+    if ($ruletype eq 'meta') {
+      my $deps = $conf->{meta_dependencies}->{$rulename};
+      push(@key, $deps, map { $tflags->{$_} } split(' ', $deps || ''));
+    }
+  }
+
+  my $clean_priority = $priority;
+  $clean_priority =~ s/-/neg/;
+  my $file = File::Spec->catfile($dir, $ruletype.'_'.$clean_priority.'.pl');
+
+  # the rules come from (tainted) config, but a hex digest of them is safe
+  my $key = sha1_hex(join("\0", map { defined $_ ? $_ : '' } @key));
+  $key = $key =~ /^([0-9a-f]{40})\z/ ? $1 : undef;
+  return if !defined $key;
+
+  return {
+    dir => Mail::SpamAssassin::Util::untaint_file_path($dir),
+    file => Mail::SpamAssassin::Util::untaint_file_path($file),
+    key => $key,
+  };
+}
+
+sub load_rule_code {
+  my ($self, $pms, $cache) = @_;
+  my $file = $cache->{file};
+
+  open(my $fh, '<', $file) or return 0;
+
+  # the key is no secret, and the code may be eval'd as root (spamd's
+  # compile_now runs before it drops privileges), so only load what
+  # nobody but this user or root could have written
+  foreach my $check ([ $cache->{dir}, stat($cache->{dir}) ],
+                     [ $file, stat($fh) ])
+  {
+    my ($path, @st) = @{$check};
+    if (!@st || ($st[4] != $> && $st[4] != 0) || ($st[2] & 022)) {
+      info("rules: not loading cached code from $file: $path must be ".
+           "owned by uid $> or root and not group or world writable");
+      close $fh;
+      return 0;
+    }
+  }
+
+  my $key = <$fh>;
+  if (!defined $key || $key ne "# $cache->{key}\n") {
+    dbg("rules: cached code in $file is out of date");
+    close $fh;
+    return 0;
+  }
+  my $code = do { local $/; <$fh> };
+  close $fh  or die "error closing $file: $!";
+
+  my $eval_result;
+  { my $timer = $self->{main}->time_method('compile_gen');
+    no warnings 'redefine';
+    $eval_result = eval(untaint_var($code));
+  }
+  if (!$eval_result) {
+    my $eval_stat = $@ ne '' ? $@ : "errno=$!";  chomp $eval_stat;
+    warn "rules: failed to compile cached code in $file, regenerating:\n".
+         "\t($eval_stat)\n";
+    return 0;
+  }
+  dbg("rules: loaded cached code from $file");
+  return 1;
+}
+
+sub save_rule_code {
+  my ($self, $pms, $cache, $code) = @_;
+  my $file = $cache->{file};
+
+  # write a new file and rename it into place, so that another process
+  # never reads a partly written one
+  my $tmpfile = "$file.$$.tmp";
+  my $fh;
+  if (!open($fh, '>', $tmpfile)) {
+    info("rules: cannot write cached code to $tmpfile: $!");
+    return;
+  }
+  # whatever the umask, load_rule_code() won't trust a writable file
+  chmod(0644, $tmpfile);
+  # keep the rename out of the statement that reads the (tainted) code,
+  # or taint mode refuses it
+  my $ok = (print $fh "# $cache->{key}\n", $code) && close($fh);
+  $ok = rename($tmpfile, $file)  if $ok;
+  if (!$ok) {
+    info("rules: cannot write cached code to $file: $!");
+    unlink($tmpfile);
+    return;
+  }
+  dbg("rules: saved compiled code to $file");
+}
+
 ###########################################################################
 
 sub do_meta_tests {
@@ -735,6 +968,8 @@ sub do_head_tests {
     $self->push_evalstr_prefix($pms, '
       no warnings q(uninitialized);
       my $hval;
+      my %lits;
+      my $lits_all;
     ');
   },
     post_loop_body => sub
@@ -743,15 +978,57 @@ sub do_head_tests {
     # setup the function to run the rules
     while(my($k,$v) = each %ordered) {
       my($hdrname, $def) = split(/\t/, $k, 2);
+
+      # the rules on one header which cannot match unless some string is
+      # in it are only run if a single scan of the header finds it
+      my %literal;
+      if (!$self->{main}->{use_rule_subs}) {
+        foreach my $rulename (@{$v}) {
+          my $tc_ref = $testcode{$rulename};
+          next unless $tc_ref && $tc_ref->[0] && $tc_ref->[1] eq '=~';
+          my $lit = Mail::SpamAssassin::Util::regexp_required_literal(
+                                                        $tc_ref->[2]);
+          $literal{$rulename} = $lit  if defined $lit;
+        }
+        %literal = ()  if keys %literal < HEAD_PREFILTER_MIN_RULES;
+      }
+
+      my $prefilter = '';
+      my %longer;
+      if (%literal) {
+        my %seen;
+        my @lits = sort { length($b) <=> length($a) || $a cmp $b }
+                     grep { !$seen{$_}++ } values %literal;
+        # at any one position the scan reports the longest string found
+        # there; the shorter ones starting there are its prefixes
+        foreach my $lit (@lits) {
+          $longer{$lit} = [ $lit, grep { length($_) > length($lit) &&
+                              substr($_, 0, length($lit)) eq $lit } @lits ];
+        }
+        my $alt = join('|', map { quotemeta } @lits);
+        $prefilter = '
+        %lits = (); $lits_all = 0;
+        if (!defined $hval) {
+        } elsif (utf8::is_utf8($hval)) {
+          $lits_all = 1;
+        } else {
+          my $lc = lc $hval;
+          $lits{$1} = 1 while $lc =~ /(?=('.$alt.'))/g;
+        }
+        ';
+      }
+
       $self->push_evalstr_prefix($pms, '
         $hval = $self->get(q{'.$hdrname.'}, ' .
                            (!defined($def) ? 'undef' : 'q{'.$def.'}') . ');
-      ');
+      '.$prefilter);
       foreach my $rulename (@{$v}) {
         if ($self->{main}->{use_rule_subs}) {
           $self->add_evalstr($pms, '
-            if ($scoresptr->{q{'.$rulename.'}}) {
+            if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+              '.$self->rule_profile_start_code().'
               '.$rulename.'_head_test($self, $hval);
+              '.$self->rule_profile_end_code($rulename).'
               '.$self->ran_rule_plugin_code($rulename, "header").'
             }
           ');
@@ -788,8 +1065,16 @@ sub do_head_tests {
             $expr = '$hval ' . $op . ' ' . $pat . $matchg;
           }
 
+          my $found_code = '';
+          if (defined $literal{$rulename}) {
+            $found_code = '($lits_all || ' . join(' || ',
+                map { '$lits{"'.quotemeta($_).'"}' }
+                  @{$longer{$literal{$rulename}}}) . ') && ';
+          }
+
           $self->add_evalstr($pms, '
-          if ($scoresptr->{q{'.$rulename.'}}) {
+          if ('.$found_code.'$scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+            '.$self->rule_profile_start_code().'
             '.$posline.'
             '.$self->hash_line_for_rule($pms, $rulename).'
             '.$ifwhile.' ('.$expr.$whlimit.') {
@@ -797,6 +1082,7 @@ sub do_head_tests {
               '.$self->hit_rule_plugin_code($pms, $rulename, "header", $hitdone,
                                             $matching_string_unavailable).'
             }
+            '.$self->rule_profile_end_code($rulename).'
             '.$self->ran_rule_plugin_code($rulename, "header").'
           }
           ');
@@ -865,16 +1151,20 @@ sub do_body_tests {
 
     if ($self->{main}->{use_rule_subs}) {
       $self->add_evalstr($pms, '
-        if ($scoresptr->{q{'.$rulename.'}}) {
+        if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+          '.$self->rule_profile_start_code().'
           '.$rulename.'_body_test($self,@_); 
+          '.$self->rule_profile_end_code($rulename).'
           '.$self->ran_rule_plugin_code($rulename, "body").'
         }
       ');
     }
     else {
       $self->add_evalstr($pms, '
-        if ($scoresptr->{q{'.$rulename.'}}) {
+        if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+          '.$self->rule_profile_start_code().'
           '.$sub.'
+          '.$self->rule_profile_end_code($rulename).'
           '.$self->ran_rule_plugin_code($rulename, "body").'
         }
       ');
@@ -942,16 +1232,20 @@ sub do_uri_tests {
 
     if ($self->{main}->{use_rule_subs}) {
       $self->add_evalstr($pms, '
-        if ($scoresptr->{q{'.$rulename.'}}) {
+        if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+          '.$self->rule_profile_start_code().'
           '.$rulename.'_uri_test($self, @_);
+          '.$self->rule_profile_end_code($rulename).'
           '.$self->ran_rule_plugin_code($rulename, "uri").'
         }
       ');
     }
     else {
       $self->add_evalstr($pms, '
-        if ($scoresptr->{q{'.$rulename.'}}) {
+        if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+          '.$self->rule_profile_start_code().'
           '.$sub.'
+          '.$self->rule_profile_end_code($rulename).'
           '.$self->ran_rule_plugin_code($rulename, "uri").'
         }
       ');
@@ -1022,16 +1316,20 @@ sub do_rawbody_tests {
 
     if ($self->{main}->{use_rule_subs}) {
       $self->add_evalstr($pms, '
-        if ($scoresptr->{q{'.$rulename.'}}) {
+        if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+           '.$self->rule_profile_start_code().'
            '.$rulename.'_rawbody_test($self, @_);
+           '.$self->rule_profile_end_code($rulename).'
            '.$self->ran_rule_plugin_code($rulename, "rawbody").'
         }
       ');
     }
     else {
       $self->add_evalstr($pms, '
-        if ($scoresptr->{q{'.$rulename.'}}) {
+        if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+          '.$self->rule_profile_start_code().'
           '.$sub.'
+          '.$self->rule_profile_end_code($rulename).'
           '.$self->ran_rule_plugin_code($rulename, "rawbody").'
         }
       ');
@@ -1072,7 +1370,8 @@ sub do_full_tests {
     my ($max) = ($pms->{conf}->{tflags}->{$rulename}||'') =~ /\bmaxhits=(\d+)\b/;
     $max = untaint_var($max);
     $self->add_evalstr($pms, '
-      if ($scoresptr->{q{'.$rulename.'}}) {
+      if ($scoresptr->{q{'.$rulename.'}}'.$self->subrule_needed_code($pms, $rulename).') {
+        '.$self->rule_profile_start_code().'
         pos $$fullmsgref = 0;
         '.$self->hash_line_for_rule($pms, $rulename).'
         dbg("rules-all: running full rule %s", q{'.$rulename.'});
@@ -1081,6 +1380,7 @@ sub do_full_tests {
           $self->got_hit(q{'.$rulename.'}, "FULL: ", ruletype => "full");
           '. $self->hit_rule_plugin_code($pms, $rulename, "full", "last") . '
         }
+        '.$self->rule_profile_end_code($rulename).'
         '.$self->ran_rule_plugin_code($rulename, "full").'
       }
     ');
@@ -1219,7 +1519,7 @@ sub run_eval_tests {
     if ($scoresptr->{q#'.$rulename.'#}) {
       $rulename = q#'.$rulename.'#;
       %{$self->{test_log_msgs}} = ();
-    ';
+    '.$self->rule_profile_start_code();
  
     # only need to set current_rule_name for plugin evals
     if ($eval_pluginsref->{$function}) {
@@ -1277,6 +1577,7 @@ sub run_eval_tests {
         $self->got_hit($rulename, $prepend2desc, ruletype => "eval", value => $result);
         '.$dbgstr.'
       }
+    '.$self->rule_profile_end_code($rulename).'
     }
     ';
   }
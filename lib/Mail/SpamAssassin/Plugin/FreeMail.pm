@@ -340,7 +340,9 @@ sub _parse_body {
         # scan stripped normalized body
         # have to do this way since get_uri_detail_list doesn't know what mails are inside <>
         my $body = $pms->get_decoded_stripped_body_text_array();
-        BODY: foreach (@$body) {
+        BODY: foreach my $line (@$body) {
+            # work on a copy, the body array is shared with the other rules
+            local $_ = $line;
             # strip urls with possible emails inside
             s#<?https?://\S{0,255}(?:\@|%40)\S{0,255}# #gi;
             # strip emails contained in <>, not mailto:
@@ -90,6 +90,9 @@ use re 'taint';
 use vars qw(@ISA);
 @ISA = qw(Mail::SpamAssassin::Plugin);
 
+# how much of a png or jpeg image is decoded at first to find its size
+use constant IMAGE_HEADER_BYTES => 16384;
+
 # constructor: register the eval rule
 sub new {
   my $class = shift;
@@ -113,6 +116,25 @@ sub new {
 
 # -----------------------------------------
 
+# The dimensions of an image are near its start, so only the beginning of
+# it is decoded into $$data at first.  The returned sub makes sure that
+# $$data reaches up to a given offset, decoding all of the image when it
+# doesn't; what the parsers below look at is then the same as if all of the
+# image had been decoded in the first place.
+sub _decode_image_start {
+  my ($part, $data) = @_;
+
+  $$data = $part->decode(IMAGE_HEADER_BYTES);
+  my $partial = length $$data >= IMAGE_HEADER_BYTES;
+
+  return sub {
+    if ($partial && $_[0] > length $$data) {
+      $$data = $part->decode();
+      $partial = 0;
+    }
+  };
+}
+
 my %get_details = (
   'gif' => sub {
     my ($pms, $part) = @_;
@@ -142,17 +164,20 @@ my %get_details = (
 
   'png' => sub {
     my ($pms, $part) = @_;
-    my $data = $part->decode();
+    my $data;
+    my $need = _decode_image_start($part, \$data);
 
     return unless (substr($data, 0, 8) eq "\x89PNG\x0d\x0a\x1a\x0a");
 
-    my $datalen = length $data;
     my $pos = 8;
     my $chunksize = 8;
     my ($width, $height) = ( 0, 0 );
     my ($depth, $ctype, $compression, $filter, $interlace);
 
-    while ($pos < $datalen) {
+    while (1) {
+      $need->($pos + $chunksize);
+      last unless $pos < length $data;
+
       my ($len, $type) = unpack("Na4", substr($data, $pos, $chunksize));
       $pos += $chunksize;
 
@@ -160,6 +185,7 @@ my %get_details = (
 
       next unless ( $type eq "IHDR" && $len == 13 );
 
+      $need->($pos + $len + 4);
       my $bytes = substr($data, $pos, $len + 4);
       my $crc = unpack("N", substr($bytes, -4, 4, ""));
 
@@ -181,7 +207,8 @@ my %get_details = (
   'jpeg' => sub {
     my ($pms, $part) = @_;
 
-    my $data = $part->decode();
+    my $data;
+    my $need = _decode_image_start($part, \$data);
 
     my $index = substr($data, 0, 2);
     return unless $index eq "\xFF\xD8";
@@ -190,11 +217,13 @@ my %get_details = (
     my $chunksize = 4;
     my ($prec, $height, $width, $comps) = (undef,0,0,undef);
     while  (1) {
+      $need->($pos + $chunksize);
       my ($xx, $mark, $len) = unpack("CCn", substr($data, $pos, $chunksize));
       last if (!defined $xx   || $xx != 0xFF);
       last if (!defined $mark || $mark == 0xDA || $mark == 0xD9);
       last if (!defined $len  || $len < 2);
       $pos += $chunksize;
+      $need->($pos + $len - 2);
       my $block = substr($data, $pos, $len - 2);
       my $blocklen = length($block);
       if ( ($mark >= 0xC0 && $mark <= 0xC3) || ($mark >= 0xC5 && $mark <= 0xC7) ||
@@ -0,0 +1,203 @@
+# <@LICENSE>
+# Licensed to the Apache Software Foundation (ASF) under one or more
+# contributor license agreements.  See the NOTICE file distributed with
+# this work for additional information regarding copyright ownership.
+# The ASF licenses this file to you under the Apache License, Version 2.0
+# (the "License"); you may not use this file except in compliance with
+# the License.  You may obtain a copy of the License at:
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# </@LICENSE>
+
+=head1 NAME
+
+Mail::SpamAssassin::Plugin::MultiBodyMatch - run body rules only when their literal text is present
+
+=head1 SYNOPSIS
+
+  loadplugin     Mail::SpamAssassin::Plugin::MultiBodyMatch
+
+=head1 DESCRIPTION
+
+Normally every body rule runs its regular expression over every line of
+the message body.  Most rules, however, cannot match unless some fixed
+string (such as C<viagra> in C</\bviagra\b/i>) appears in the text.
+
+This plugin finds such a string for each body rule when the rules are
+parsed, and joins the strings of all rules at a priority into a single
+alternation, which perl compiles into one trie matcher.  At scan time the
+body is searched once with that matcher, and only the rules whose string
+was found have their real regular expression run.  Rules for which no
+string can be found, or which use C<tflags multiple>, are left to the
+normal body rule loop; so is everything when the body contains wide
+characters, since case folding is then no longer a simple C<lc>.
+
+If C<Rule2XSBody> is also in use, load this plugin after it, so that the
+rules it handles are left alone.
+
+=cut
+
+package Mail::SpamAssassin::Plugin::MultiBodyMatch;
+
+use Mail::SpamAssassin::Plugin;
+use Mail::SpamAssassin::Logger;
+use Mail::SpamAssassin::Util qw(untaint_var);
+use Mail::SpamAssassin::Plugin::OneLineBodyRuleType;
+
+use strict;
+use warnings;
+use bytes;
+use re 'taint';
+
+use vars qw(@ISA);
+@ISA = qw(Mail::SpamAssassin::Plugin);
+
+# strings shorter than this occur in too many messages to be worth it
+use constant MIN_LITERAL_LENGTH => 3;
+
+sub new {
+  my $class = shift;
+  my $mailsaobject = shift;
+  $class = ref($class) || $class;
+  my $self = $class->SUPER::new($mailsaobject);
+  bless ($self, $class);
+  $self->{one_line_body} = Mail::SpamAssassin::Plugin::OneLineBodyRuleType->new();
+  return $self;
+}
+
+###########################################################################
+
+sub finish_parsing_end {
+  my ($self, $params) = @_;
+  my $conf = $params->{conf};
+
+  $conf->{skip_body_rules}   ||= { };
+  $conf->{multi_body_match}  = { };
+
+  my ($found, $total) = (0, 0);
+  foreach my $pri (keys %{$conf->{body_tests}}) {
+    my $rules = $conf->{body_tests}->{$pri};
+    my %by_literal;
+
+    foreach my $name (keys %{$rules}) {
+      $total++;
+
+      # already taken care of by another plugin, eg. Rule2XSBody
+      next if $conf->{skip_body_rules}->{$name};
+      next if ($conf->{tflags}->{$name}||'') =~ /\bmultiple\b/;
+      next if $conf->{rules_to_replace}->{$name};
+
+      my $literal = Mail::SpamAssassin::Util::regexp_required_literal(
+                          $rules->{$name}, MIN_LITERAL_LENGTH);
+      next if !defined $literal;
+
+      push(@{$by_literal{$literal}}, $name);
+      $conf->{skip_body_rules}->{$name} = 1;
+      $conf->{generate_body_one_line_sub}->{$name} = 1;
+      $found++;
+    }
+    next if !%by_literal;
+
+    # longest first, so that at any one position the trie reports the
+    # longest string; the shorter ones starting there are its prefixes
+    my @literals = sort { length($b) <=> length($a) || $a cmp $b }
+                        keys %by_literal;
+    my $alt = join('|', map { quotemeta } @literals);
+
+    my %prefixes;
+    foreach my $literal (@literals) {
+      for my $len (MIN_LITERAL_LENGTH .. length($literal)-1) {
+        my $prefix = substr($literal, 0, $len);
+        push(@{$prefixes{$literal}}, $prefix) if $by_literal{$prefix};
+      }
+    }
+
+    $conf->{multi_body_match}->{$pri} = {
+      re => qr/(?=($alt))/,
+      rules => \%by_literal,
+      prefixes => \%prefixes,
+    };
+  }
+
+  dbg("multibody: %d of %d body rules are prefiltered by literal text",
+      $found, $total);
+}
+
+###########################################################################
+
+# delegate these to the OneLineBodyRuleType object
+sub check_start {
+  my ($self, $params) = @_;
+  $self->{one_line_body}->check_start($params);
+}
+
+sub check_rules_at_priority {
+  my ($self, $params) = @_;
+  $self->{one_line_body}->check_rules_at_priority($params);
+}
+
+###########################################################################
+
+sub run_body_fast_scan {
+  my ($self, $params) = @_;
+
+  return unless ($params->{ruletype} eq 'body');
+
+  my $scanner = $params->{permsgstatus};
+  my $conf = $scanner->{conf};
+  my $set = $conf->{multi_body_match}->{$params->{priority}};
+  return unless $set;
+
+  my $lines = $params->{lines};
+  my $scoresptr = $conf->{scores};
+  my $rules = $set->{rules};
+
+  my @names;
+  if (grep { utf8::is_utf8($_) } @{$lines}) {
+    dbg("multibody: wide characters in body, not prefiltering");
+    @names = map { @{$_} } values %{$rules};
+  }
+  else {
+    my $text = lc join("\n", @{$lines});
+    my $re = $set->{re};
+    my $prefixes = $set->{prefixes};
+
+    my %found;
+    while ($text =~ /$re/g) {
+      next if exists $found{$1};
+      $found{$1} = undef;
+      $found{$_} = undef for @{$prefixes->{$1} || []};
+    }
+    @names = map { @{$rules->{$_}} } keys %found;
+  }
+
+  dbg("multibody: %d candidate body rules at priority %s",
+      scalar @names, $params->{priority});
+
+  {
+    no strict "refs";
+    foreach my $rulename (@names) {
+      # ignore 0-scored rules, of course
+      next unless $scoresptr->{$rulename};
+
+      my $fn = 'Mail::SpamAssassin::Plugin::Check::'.
+                        $rulename.'_one_line_body_test';
+      next unless defined &{$fn};
+
+      foreach my $line (@{$lines}) {
+        last if &{$fn}($scanner, $line);
+      }
+    }
+    use strict "refs";
+  }
+}
+
+###########################################################################
+
+1;
@@ -17,6 +17,15 @@ use re 'taint';
 
 use vars qw(@ISA); @ISA = qw();
 
+# the rule types which can be run one line (or one URI, or one header
+# value) at a time, with the area each reports its hits in
+our %ONE_LINE_AREAS = (
+  body    => 'BODY: ',
+  rawbody => 'RAW: ',
+  uri     => 'URI: ',
+  head    => '',
+);
+
 # constructor
 sub new {
   my $class = shift;
@@ -33,8 +42,19 @@ sub check_rules_at_priority {
   my $pms = $params->{permsgstatus};
   my $checkobj = $params->{checkobj};
   my $priority = $params->{priority};
+  my $conf = $pms->{conf};
+
+  # several plugins may delegate to us; only run the set once
+  return if $pms->{one_line_body_tests_done}->{$priority}++;
+
   Mail::SpamAssassin::Plugin::Check::do_one_line_body_tests($checkobj,
             $pms, $priority);
+
+  foreach my $type (qw(rawbody uri head)) {
+    next unless $conf->{'generate_'.$type.'_one_line_sub'};
+    Mail::SpamAssassin::Plugin::Check::do_one_line_tests($checkobj,
+            $pms, $priority, $type);
+  }
 }
 
 sub check_start {
@@ -46,21 +66,27 @@ sub check_start {
   # finish_tests().  perfect spot to remove rules from the body
   # set and add to another set...
 
-  my $test_set = $conf->{body_tests};
-  foreach my $pri (keys %{$test_set})
-  {
-    foreach my $rulename (keys %{$test_set->{$pri}})
+  foreach my $type (sort keys %ONE_LINE_AREAS) {
+    my $generate = $conf->{'generate_'.$type.'_one_line_sub'};
+    my $skip = $conf->{'skip_'.$type.'_rules'};
+    next unless $generate || $skip;
+
+    my $test_set = $conf->{$type.'_tests'};
+    foreach my $pri (keys %{$test_set})
     {
-      if ($conf->{generate_body_one_line_sub}->{$rulename}) {
-        # add the rule to the one-liner set
-        $conf->{one_line_body_tests}->{$pri} ||= { };
-        $conf->{one_line_body_tests}->{$pri}->{$rulename} =
-                    $test_set->{$pri}->{$rulename};
-      }
+      foreach my $rulename (keys %{$test_set->{$pri}})
+      {
+        if ($generate && $generate->{$rulename}) {
+          # add the rule to the one-liner set
+          $conf->{'one_line_'.$type.'_tests'}->{$pri} ||= { };
+          $conf->{'one_line_'.$type.'_tests'}->{$pri}->{$rulename} =
+                      $test_set->{$pri}->{$rulename};
+        }
 
-      if ($conf->{skip_body_rules}->{$rulename}) {
-        # remove from the body set
-        delete $test_set->{$pri}->{$rulename};
+        if ($skip && $skip->{$rulename}) {
+          # remove from the original set
+          delete $test_set->{$pri}->{$rulename};
+        }
       }
     }
   }
@@ -68,6 +94,36 @@ sub check_start {
 
 ###########################################################################
 
+# Split a 'header' rule into its header name and pattern.  Only the plain
+# "Name =~ /pattern/" form can be run as a one-line rule; negated matches,
+# function-style tests and [if-unset: ...] defaults return nothing.
+sub split_head_rule {
+  my ($rule) = @_;
+  local ($1,$2);
+  return unless $rule =~ /^\s* (\S+) \s* =~ \s* (\S .*? \S) \s*$/x;
+  my ($hdrname, $pat) = ($1, $2);
+  return if $pat =~ /\s\[if-unset:\s/;
+  return ($hdrname, $pat);
+}
+
+# the name of a set of compiled rules, and of the module holding them:
+# "body_0", "uri_neg100", or for header rules, one set per header name,
+# "head_Subject_0".  Characters which cannot appear in a perl package name
+# are hex-encoded, as is "_" itself, to keep the names distinct.
+sub zoom_set_name {
+  my ($type, $pri, $hdrname) = @_;
+  my $nicepri = $pri; $nicepri =~ s/-/neg/g;
+  my $name = $type.'_'.$nicepri;
+  if (defined $hdrname) {
+    my $nicehdr = $hdrname;
+    $nicehdr =~ s/([^A-Za-z0-9])/sprintf("_%02x", ord $1)/ges;
+    $name = $type.'_'.$nicehdr.'_'.$nicepri;
+  }
+  return untaint_var($name);
+}
+
+###########################################################################
+
 1;
 
 # inject this method into the Check plugin's namespace
@@ -76,19 +132,38 @@ package Mail::SpamAssassin::Plugin::Check;
 
 sub do_one_line_body_tests {
   my ($self, $pms, $priority) = @_;
+  do_one_line_tests($self, $pms, $priority, 'body');
+}
+
+sub do_one_line_tests {
+  my ($self, $pms, $priority, $type) = @_;
+
+  my $ruletype = 'one_line_'.$type;
+  my $area = $Mail::SpamAssassin::Plugin::OneLineBodyRuleType::ONE_LINE_AREAS{$type};
+  my %consttypes = (
+    body    => $Mail::SpamAssassin::Conf::TYPE_BODY_TESTS,
+    rawbody => $Mail::SpamAssassin::Conf::TYPE_RAWBODY_TESTS,
+    uri     => $Mail::SpamAssassin::Conf::TYPE_URI_TESTS,
+    head    => $Mail::SpamAssassin::Conf::TYPE_HEAD_TESTS,
+  );
 
   # TODO: should have a consttype for plugin-defined "alien" rule types,
   # probably something like TYPE_ALIEN_TESTS.  it's only used as a key
   # for {user_rules_of_type}, so that should be fine
 
   $self->run_generic_tests ($pms, $priority,
-    consttype => $Mail::SpamAssassin::Conf::TYPE_BODY_TESTS,
-    type => 'one_line_body',
-    testhash => $pms->{conf}->{one_line_body_tests},
+    consttype => $consttypes{$type},
+    type => $ruletype,
+    testhash => $pms->{conf}->{$ruletype.'_tests'},
     args => [ ],
     loop_body => sub
   {
     my ($self, $pms, $conf, $rulename, $pat, %opts) = @_;
+    if ($type eq 'head') {
+      (undef, $pat) =
+        Mail::SpamAssassin::Plugin::OneLineBodyRuleType::split_head_rule($pat);
+      return if !defined $pat;
+    }
     $pat = untaint_var($pat);
     my $sub;
 
@@ -101,8 +176,8 @@ sub do_one_line_body_tests {
       '.$self->hash_line_for_rule($pms, $rulename).'
       while ($$lref =~ '.$pat.'g) {
         my $self = $_[0];
-        $self->got_hit(q{'.$rulename.'}, "BODY: ", ruletype => "one_line_body");
-        '. $self->hit_rule_plugin_code($pms, $rulename, "one_line_body",
+        $self->got_hit(q{'.$rulename.'}, "'.$area.'", ruletype => "'.$ruletype.'");
+        '. $self->hit_rule_plugin_code($pms, $rulename, $ruletype,
                                       "return 1") . '
       }
       ';
@@ -112,30 +187,69 @@ sub do_one_line_body_tests {
       '.$self->hash_line_for_rule($pms, $rulename).'
       if ($_[1] =~ '.$pat.') {
         my $self = $_[0];
-        $self->got_hit(q{'.$rulename.'}, "BODY: ", ruletype => "one_line_body");
-        '. $self->hit_rule_plugin_code($pms, $rulename, "one_line_body", "return 1") . '
+        $self->got_hit(q{'.$rulename.'}, "'.$area.'", ruletype => "'.$ruletype.'");
+        '. $self->hit_rule_plugin_code($pms, $rulename, $ruletype, "return 1") . '
       }
       ';
 
     }
 
     return if ($opts{doing_user_rules} &&
-                  !$self->is_user_rule_sub($rulename.'_one_line_body_test'));
+                  !$self->is_user_rule_sub($rulename.'_'.$ruletype.'_test'));
 
-    $self->add_temporary_method ($rulename.'_one_line_body_test', '{'.$sub.'}');
+    $self->add_temporary_method ($rulename.'_'.$ruletype.'_test', '{'.$sub.'}');
   },
     pre_loop_body => sub
   {
     my ($self, $pms, $conf, %opts) = @_;
-    $self->add_evalstr($pms, '
- 
-      my $bodytext = $self->get_decoded_stripped_body_text_array();
-      $self->{main}->call_plugins("run_body_fast_scan", {
-              permsgstatus => $self, ruletype => "body",
-              priority => '.$opts{priority}.', lines => $bodytext
-            });
-
-    ');
+    my $rules = $conf->{$ruletype.'_tests'}->{$opts{priority}} || { };
+
+    if ($type eq 'body') {
+      $self->add_evalstr($pms, '
+
+        my $bodytext = $self->get_decoded_stripped_body_text_array();
+        $self->{main}->call_plugins("run_body_fast_scan", {
+                permsgstatus => $self, ruletype => "body",
+                priority => '.$opts{priority}.', lines => $bodytext
+              });
+
+      ');
+    }
+    elsif ($type eq 'head') {
+      # one scan per header name, over the same value the rule would see
+      my %hdrnames;
+      foreach my $rule (values %{$rules}) {
+        my ($hdrname) =
+          Mail::SpamAssassin::Plugin::OneLineBodyRuleType::split_head_rule($rule);
+        $hdrnames{$hdrname} = 1 if defined $hdrname;
+      }
+      foreach my $hdrname (sort keys %hdrnames) {
+        $self->add_evalstr($pms, '
+          {
+            my $hval = $self->get(q{'.$hdrname.'}, undef);
+            if (defined $hval) {
+              $self->{main}->call_plugins("run_body_fast_scan", {
+                      permsgstatus => $self, ruletype => "head",
+                      header => q{'.$hdrname.'},
+                      priority => '.$opts{priority}.', lines => [ $hval ]
+                    });
+            }
+          }
+        ');
+      }
+    }
+    elsif (%{$rules}) {
+      my $lines = $type eq 'uri' ? '[ $self->get_uri_list() ]'
+                                 : '$self->get_decoded_body_text_array()';
+      $self->add_evalstr($pms, '
+
+        $self->{main}->call_plugins("run_body_fast_scan", {
+                permsgstatus => $self, ruletype => "'.$type.'",
+                priority => '.$opts{priority}.', lines => '.$lines.'
+              });
+
+      ');
+    }
   });
 }
 
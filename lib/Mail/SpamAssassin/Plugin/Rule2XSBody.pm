@@ -31,6 +31,13 @@ Note that C<sa-compile> must be run in advance, in order to compile the
 ruleset using C<re2c> and the C compiler.  See the C<sa-compile>
 documentation for more details.
 
+Besides 'body' rules, 'rawbody' and 'uri' rules are compiled, as are
+'header' rules of the simple C<Name =~ /pattern/> form, with one compiled
+scanner per header name.  With C<-D zoom>, a summary of how many scans,
+scanned strings, candidate rules and confirmed hits each rule type saw is
+logged when SpamAssassin finishes; the time spent in each type's scanners
+appears in the C<timing> report as C<zoom_body>, C<zoom_head> etc.
+
 =cut
 
 package Mail::SpamAssassin::Plugin::Rule2XSBody;
@@ -68,7 +75,18 @@ sub finish_parsing_end {
   unshift @INC, $instdir, "$instdir/auto";
   dbg "zoom: loading compiled ruleset from $instdir";
 
+  $self->{zoom_found} = { };
   $self->setup_test_set ($conf, $conf->{body_tests}, 'body');
+  $self->setup_test_set ($conf, $conf->{rawbody_tests}, 'rawbody');
+  $self->setup_test_set ($conf, $conf->{uri_tests}, 'uri');
+  $self->setup_head_test_set ($conf, $conf->{head_tests});
+
+  my $found = $self->{zoom_found};
+  if (%{$found}) {
+    $self->{compiled_rules_log_msg_text} = "able to use ".join(", ",
+          map { "$found->{$_}->[0]/$found->{$_}->[1] '$_'" } sort keys %{$found}).
+          " compiled rules";
+  }
 }
 
 sub compile_now_start {
@@ -84,13 +102,37 @@ sub compile_now_start {
 sub setup_test_set {
   my ($self, $conf, $test_set, $ruletype) = @_;
   foreach my $pri (keys %{$test_set}) {
-    my $nicepri = $pri; $nicepri =~ s/-/neg/g;
-    $self->setup_test_set_pri($conf, $test_set->{$pri}, $ruletype.'_'.$nicepri);
+    $self->setup_test_set_pri($conf, $test_set->{$pri},
+        Mail::SpamAssassin::Plugin::OneLineBodyRuleType::zoom_set_name(
+                                                        $ruletype, $pri),
+        $ruletype);
+  }
+}
+
+sub setup_head_test_set {
+  my ($self, $conf, $test_set) = @_;
+  foreach my $pri (keys %{$test_set}) {
+    # the compiled sets hold the pattern alone, grouped by header name
+    my %by_header;
+    foreach my $name (keys %{$test_set->{$pri}}) {
+      my ($hdrname, $pat) =
+        Mail::SpamAssassin::Plugin::OneLineBodyRuleType::split_head_rule(
+                                            $test_set->{$pri}->{$name});
+      next if !defined $hdrname;
+      $by_header{$hdrname}->{$name} = $pat;
+    }
+
+    foreach my $hdrname (keys %by_header) {
+      $self->setup_test_set_pri($conf, $by_header{$hdrname},
+          Mail::SpamAssassin::Plugin::OneLineBodyRuleType::zoom_set_name(
+                                                'head', $pri, $hdrname),
+          'head');
+    }
   }
 }
 
 sub setup_test_set_pri {
-  my ($self, $conf, $rules, $ruletype) = @_;
+  my ($self, $conf, $rules, $ruletype, $type) = @_;
 
   my $modname = "Mail::SpamAssassin::CompiledRegexps::".$ruletype;
   my $modpath = "Mail/SpamAssassin/CompiledRegexps/".$ruletype.".pm";
@@ -110,8 +152,19 @@ sub setup_test_set_pri {
   }
   dbg "zoom: using compiled ruleset in $file for $modname";
 
-  $conf->{skip_body_rules}   ||= { };
-  $conf->{need_one_line_sub} ||= { };
+  # modules from an older sa-compile only have the per-line scan()
+  {
+    no strict "refs";
+    if (defined &{$modname.'::scan_lines'}) {
+      $self->{zoom_scan_lines}->{$ruletype} = \&{$modname.'::scan_lines'};
+      $self->{zoom_rule_ids}->{$ruletype} = [
+                ${$modname.'::RULE_NAMES'}, ${$modname.'::RULE_NONLOSSY'} ];
+    }
+    use strict "refs";
+  }
+
+  my $skip_rules = $conf->{'skip_'.$type.'_rules'} ||= { };
+  my $generate = $conf->{'generate_'.$type.'_one_line_sub'} ||= { };
 
   my %longname;
   foreach my $nameandflags (keys %{$hasrules}) {
@@ -143,19 +196,30 @@ sub setup_test_set_pri {
       next;
     }
 
+    # the one-line tests do not honour "maxhits"; rather than spread
+    # that to the other rule types, leave their "multiple" rules alone
+    if ($type ne 'body' && ($conf->{tflags}->{$name}||'') =~ /\bmultiple\b/) {
+      dbg "zoom: skipping rule $name, tflags multiple";
+      next;
+    }
+
     # we have the rule, and its regexp matches.  zero out the body
     # rule, so that the module can do the work instead
 
     # TODO: need a cleaner way to do this.  I expect when rule types
     # are implementable in plugins, I can do it that way
-    $conf->{skip_body_rules}->{$name} = 1;
+    $skip_rules->{$name} = 1;
 
     # ensure that the one-liner version of the function call is
     # created, though
-    $conf->{generate_body_one_line_sub}->{$name} = 1;
+    $generate->{$name} = 1;
     $found++;
   }
 
+  my $totals = $self->{zoom_found}->{$type} ||= [ 0, 0 ];
+  $totals->[0] += $found;
+  $totals->[1] += scalar keys %{$hasrules};
+
   if ($found) {
     # report how many of the zoomed rules could be used; when this
     # figure gets low, it's a good indication that the rule2xs
@@ -165,9 +229,8 @@ sub setup_test_set_pri {
     my $pc_zoomed   = ($found / ($totalhasrules || .001)) * 100;
     $pc_zoomed   = int($pc_zoomed * 1000) / 1000;
 
-    $self->{compiled_rules_log_msg_text} = "able to use $found/".
-        "$totalhasrules '$ruletype' compiled rules ($pc_zoomed\%)";
-    dbg("zoom: $self->{compiled_rules_log_msg_text}");
+    dbg("zoom: able to use $found/".
+        "$totalhasrules '$ruletype' compiled rules ($pc_zoomed\%)");
 
     # TODO: issue a warning for low counts?
     # TODO: inhibit rule2xs scanning entirely for low counts?
@@ -201,67 +264,72 @@ sub check_rules_at_priority {
 sub run_body_fast_scan {
   my ($self, $params) = @_;
 
-  return unless ($params->{ruletype} eq 'body');
+  my $type = $params->{ruletype};
+  my $area = $Mail::SpamAssassin::Plugin::OneLineBodyRuleType::ONE_LINE_AREAS{$type};
+  return unless defined $area;
 
-  my $nicepri = $params->{priority}; $nicepri =~ s/-/neg/g;
-  my $ruletype = ($params->{ruletype}.'_'.$nicepri);
+  my $ruletype = Mail::SpamAssassin::Plugin::OneLineBodyRuleType::zoom_set_name(
+                        $type, $params->{priority}, $params->{header});
   my $scanner = $params->{permsgstatus};
   my $conf = $scanner->{conf};
   return unless $conf->{zoom_ruletypes_available}->{$ruletype};
 
   dbg("zoom: run_body_fast_scan for $ruletype start");
+  my $timer = $self->{main}->time_method("zoom_".$type);
 
   my $do_dbg = (would_log('dbg', 'zoom') > 1);
 
   my $scoresptr = $conf->{scores};
-  my $modname = "Mail::SpamAssassin::CompiledRegexps::".$ruletype;
+  my $lines = $params->{lines};
+  my $stats = $self->{zoom_stats}->{$type} ||= [ 0, 0, 0, 0 ];
+  $stats->[0]++;
+  $stats->[1] += scalar @{$lines};
+
+  # a flat list of (line index, rule ID) pairs, each rule once per line
+  my ($results, $names, $nonlossy);
+  if (my $scan_lines = $self->{zoom_scan_lines}->{$ruletype}) {
+    # the module folds case itself, and takes all the lines in one call
+    $results = &{$scan_lines}($lines);
+    ($names, $nonlossy) = @{$self->{zoom_rule_ids}->{$ruletype}};
+  } else {
+    ($results, $names, $nonlossy) = scan_lines_compat(
+              "Mail::SpamAssassin::CompiledRegexps::".$ruletype, $lines);
+  }
 
   {
     no strict "refs";
-    foreach my $line (@{$params->{lines}})
-    {
-      # unfortunately, calling lc() here seems to be the fastest
-      # way to support this and still work with UTF-8 ok
-      my $results = &{$modname.'::scan'}(lc $line);
-
-      my %alreadydone;
-      foreach my $ruleandflags (@{$results})
-      {
-        # only try each rule once per line
-        next if exists $alreadydone{$ruleandflags};
-        $alreadydone{$ruleandflags} = undef;
-
-        my $rulename = $ruleandflags;
-        my $flags = ($rulename =~ s/,\[(.*?)\]$//)?$1:'';
-
-        # ignore 0-scored rules, of course
-        next unless $scoresptr->{$rulename};
+    for (my $i = 0; $i < @{$results}; $i += 2) {
+      my $id = $results->[$i+1];
+      my $rulename = $names->[$id];
+
+      # ignore 0-scored rules, of course
+      next unless $scoresptr->{$rulename};
+      $stats->[2]++;
+
+      # non-lossy rules; the re2c version matches exactly what
+      # the perl regexp matches, so we don't need to perform
+      # a validation match to follow up; it's a hit!
+      if ($nonlossy->[$id]) {
+        $scanner->got_hit($rulename, $area, ruletype => "one_line_".$type);
+        $stats->[3]++;
+        # TODO: hit_rule_plugin_code? it's just debugging really
+        next;
+      }
 
-        # non-lossy rules; the re2c version matches exactly what
-        # the perl regexp matches, so we don't need to perform
-        # a validation match to follow up; it's a hit!
-        if ($flags =~ /\bl=0/) {
-          $scanner->got_hit($rulename, "BODY: ", ruletype => "one_line_body");
-          # TODO: hit_rule_plugin_code? it's just debugging really
-          next;
+      my $fn = 'Mail::SpamAssassin::Plugin::Check::'.
+                          $rulename.'_one_line_'.$type.'_test';
+
+      # run the real regexp -- on this line alone.
+      # don't try this unless the fn exists; this can happen if the
+      # installed compiled-rules file contains details of rules
+      # that are not in our current ruleset (e.g. gets out of
+      # sync, or was compiled with extra rulesets installed)
+      if (defined &{$fn}) {
+        if (&{$fn} ($scanner, $lines->[$results->[$i]])) {
+          $stats->[3]++;
+        } elsif ($do_dbg) {
+          $self->{rule2xs_misses}->{$rulename}++;
         }
-
-	# dbg("zoom: base found for $rulename: $line");
-	# }
-
-	my $fn = 'Mail::SpamAssassin::Plugin::Check::'.
-				$rulename.'_one_line_body_test';
-
-        # run the real regexp -- on this line alone.
-	# don't try this unless the fn exists; this can happen if the
-	# installed compiled-rules file contains details of rules
-	# that are not in our current ruleset (e.g. gets out of
-	# sync, or was compiled with extra rulesets installed)
-	if (defined &{$fn}) {
-	  if (!&{$fn} ($scanner, $line) && $do_dbg) {
-	    $self->{rule2xs_misses}->{$rulename}++;
-	  }
-	}
       }
     }
     use strict "refs";
@@ -270,9 +338,56 @@ sub run_body_fast_scan {
   dbg("zoom: run_body_fast_scan for $ruletype done");
 }
 
+# Scan with a module built by an older sa-compile, whose scan() takes one
+# line at a time, in lower case, and returns "rule,[flags]" strings; the
+# results are returned in the same form as scan_lines() gives them.
+sub scan_lines_compat {
+  my ($modname, $lines) = @_;
+
+  my (@results, %ids, @names, @nonlossy);
+  no strict "refs";
+  for (my $lineno = 0; $lineno < @{$lines}; $lineno++) {
+    # unfortunately, calling lc() here seems to be the fastest
+    # way to support this and still work with UTF-8 ok
+    my $found = &{$modname.'::scan'}(lc $lines->[$lineno]);
+
+    my %alreadydone;
+    foreach my $ruleandflags (@{$found}) {
+      # only try each rule once per line
+      next if exists $alreadydone{$ruleandflags};
+      $alreadydone{$ruleandflags} = undef;
+
+      my $id = $ids{$ruleandflags};
+      if (!defined $id) {
+        my $rulename = $ruleandflags;
+        my $flags = ($rulename =~ s/,\[(.*?)\]$//)?$1:'';
+        $id = $ids{$ruleandflags} = scalar @names;
+        push @names, $rulename;
+        push @nonlossy, ($flags =~ /\bl=0/) ? 1 : 0;
+      }
+      push @results, $lineno, $id;
+    }
+  }
+  use strict "refs";
+
+  return (\@results, \@names, \@nonlossy);
+}
+
 sub finish {
   my ($self) = @_;
 
+  return unless would_log('dbg', 'zoom');
+
+  # per-ruletype summary: how much text went through the scanners, and
+  # how many of the rules they pointed at turned out to be hits
+  my $stats = $self->{zoom_stats};
+  foreach my $type (sort keys %{$stats}) {
+    my ($scans, $strings, $candidates, $hits) = @{$stats->{$type}};
+    dbg("zoom: %s: %d scans of %d strings, %d candidate rules, %d hits (%.1f%%)",
+        $type, $scans, $strings, $candidates, $hits,
+        $candidates ? 100 * $hits / $candidates : 0);
+  }
+
   my $do_dbg = (would_log('dbg', 'zoom') > 1);
   return unless $do_dbg;
 
@@ -37,6 +37,10 @@ Recomended usage is to use C<priority> to set rules with strong S/O values (ie.
 1.0) to be run first, and make instant spam or ham classification based on
 that.
 
+With C<shortcircuit_score_bound> enabled, the plugin will also stop once
+the score a message has reached is so far from C<required_score> that the
+rules still to run cannot bring it back across, whichever rules were hit.
+
 =cut
 
 package Mail::SpamAssassin::Plugin::Shortcircuit;
@@ -51,6 +55,21 @@ use re 'taint';
 use vars qw(@ISA);
 @ISA = qw(Mail::SpamAssassin::Plugin);
 
+# eval functions which hit their rule with a score of their own making,
+# rather than the configured one, so there is no telling what they may add;
+# each with the setting without which it never hits
+our %DYNAMIC_SCORE_EVALS = (
+  check_from_in_auto_whitelist => 'use_auto_whitelist',
+);
+
+# likewise for rules which plugins hit directly, with a score of their own,
+# whenever they see fit; each with the setting that enables it
+our %DYNAMIC_SCORE_HITS = (
+  PHISHTAG_TOSS => 'trigger_ratio',
+);
+
+my $INFINITY = 9**9**9;
+
 sub new {
   my $class = shift;
   my $mailsaobject = shift;
@@ -205,6 +224,36 @@ for that rule.
     type => $Mail::SpamAssassin::Conf::CONF_TYPE_NUMERIC
   });
 
+=item shortcircuit_score_bound (0|1)	(default: 0)
+
+Stop running rules as soon as the outcome is certain.  After each priority,
+the score so far is compared with the largest total that the rules at later
+priorities could still add, and the largest total they could take away,
+going by their scores in the current score set.  If even the worst case
+leaves the message on the same side of C<required_score>, the remaining
+rules, including the wait for outstanding network lookups, are skipped.
+
+Network rules are counted as still to come at every priority, since their
+answers can arrive at any time.  A C<tflags multiple> rule counts for its
+C<maxhits> limit, and without one makes the bound unlimited in its
+direction; so does a rule such as C<AWL> which makes up its own score, as
+long as it is switched on (C<use_auto_whitelist>), and the PhishTag plugin's
+C<PHISHTAG_TOSS> while its C<trigger_ratio> is above 0.
+
+The message is then marked as short-circuited C<spam> or C<ham>, and hits
+C<SHORTCIRCUIT> with a token score of 0.0001 or -0.0001; its reported score
+is that of the rules which did run.  Since auto-learning needs the results
+of all rules, nothing is skipped for a message which might be auto-learned,
+so this is most useful with C<bayes_auto_learn 0>.
+
+=cut
+
+  push (@cmds, {
+    setting => 'shortcircuit_score_bound',
+    default => 0,
+    type => $Mail::SpamAssassin::Conf::CONF_TYPE_BOOL
+  });
+
   $conf->{parser}->register_commands(\@cmds);
 }
 
@@ -270,6 +319,7 @@ sub parsed_metadata {
       my $rule = $scan->{shortcircuit_rule};
       my $type = $scan->{shortcircuit_type};
       return "$rule ($type)" if ($rule);
+      return "score bound ($type)" if ($type);
       return "no";
     });
 
@@ -288,6 +338,149 @@ sub parsed_metadata {
         }); 
 }
 
+# called at the end of each priority in check_main()
+sub check_tick {
+  my ($self, $params) = @_;
+
+  my $scan = $params->{permsgstatus};
+  my $priority = $params->{priority};
+  my $conf = $scan->{conf};
+
+  return unless defined $priority && $conf->{shortcircuit_score_bound};
+  return if ($scan->{lint_rules});
+  return if ($self->{am_compiling});
+  return if exists $scan->{shortcircuit_type};
+
+  # the learner wants to see every rule's result
+  return if ($conf->{use_bayes} && $conf->{bayes_auto_learn} &&
+             !$scan->{disable_auto_learning});
+
+  my $bounds = $self->score_bounds($conf);
+  my $score = $scan->{score};
+  my $required = $conf->{required_score};
+
+  my $max_pos = $bounds->{late_pos};
+  my $max_neg = $bounds->{late_neg};
+  foreach my $pri (@{$bounds->{priorities}}) {
+    next if $pri <= $priority;
+    $max_pos += $bounds->{pos}->{$pri};
+    $max_neg += $bounds->{neg}->{$pri};
+  }
+
+  my $sctype;
+  if ($score + $max_neg >= $required) {
+    $sctype = 'spam';
+  } elsif ($score + $max_pos < $required) {
+    $sctype = 'ham';
+  }
+  return unless $sctype;
+
+  dbg("shortcircuit: s/c $sctype after priority $priority, score $score ".
+      "can move by at most +$max_pos/$max_neg");
+
+  $scan->{shortcircuit_type} = $sctype;
+  $scan->{disable_auto_learning} = 1;
+  $scan->got_hit('SHORTCIRCUIT', '',
+                 score => ($sctype eq 'ham' ? -0.0001 : 0.0001));
+}
+
+# {tests} and {priority} are gone by the time messages are checked, so
+# note now when each rule runs; undef for rules which may hit at any time
+sub finish_parsing_end {
+  my ($self, $params) = @_;
+  my $conf = $params->{conf};
+
+  # user_prefs may have changed the scores
+  delete $conf->{shortcircuit_score_bounds};
+  return unless $conf->{tests};
+
+  my %rule_pri;
+  while (my ($rule, $text) = each %{$conf->{tests}}) {
+    my $type = $conf->{test_types}->{$rule};
+    my $tflags = $conf->{tflags}->{$rule} || '';
+
+    if ($type == $Mail::SpamAssassin::Conf::TYPE_RBL_EVALS
+        || $tflags =~ /\bnet\b/)
+    {
+      $rule_pri{$rule} = undef;   # answered whenever the lookup completes
+      next;
+    }
+    $rule_pri{$rule} = $conf->{priority}->{$rule} || 0;
+
+    if (($type & 1) == 1) {
+      my ($function) = ($text =~ /^\s*(\w+)/);
+      if (defined $function && $DYNAMIC_SCORE_EVALS{$function}) {
+        $rule_pri{$rule} .= " dynamic=$function";
+      }
+    }
+  }
+  $conf->{shortcircuit_rule_pri} = \%rule_pri;
+}
+
+sub user_conf_parsing_end {
+  my ($self, $params) = @_;
+  $self->finish_parsing_end($params);
+}
+
+# Sum up, per priority, the most that the rules at that priority could add
+# to and take away from the score.  Rules which may hit at any time are
+# summed separately, as {late_pos} and {late_neg}.  Cached per score set.
+sub score_bounds {
+  my ($self, $conf) = @_;
+
+  my $set = $conf->get_score_set();
+  my $cache = $conf->{shortcircuit_score_bounds};
+  return $cache->{$set} if $cache && $cache->{$set};
+
+  my $rule_pri = $conf->{shortcircuit_rule_pri} || { };
+  my (%pos, %neg);
+  my ($late_pos, $late_neg) = (0, 0);
+
+  while (my ($rule, $score) = each %{$conf->{scores}}) {
+    next unless $score;
+    next if $rule eq 'SHORTCIRCUIT';
+
+    my $tflags = $conf->{tflags}->{$rule} || '';
+    my ($pos, $neg) = ($score > 0) ? ($score, 0) : (0, $score);
+
+    if ($tflags =~ /\bmultiple\b/) {
+      my $maxhits = ($tflags =~ /\bmaxhits=(\d+)\b/) ? $1 : $INFINITY;
+      $pos *= $maxhits if $pos;
+      $neg *= $maxhits if $neg;
+    }
+
+    # rules with no test are hit by plugins, at no particular priority
+    my $pri = $rule_pri->{$rule};
+    if (!defined $pri) {
+      $late_pos += $pos; $late_neg += $neg;
+      next;
+    }
+    if ($pri =~ s/ dynamic=(\w+)$//) {
+      # unlimited, unless it's switched off and can't hit at all
+      my $setting = $DYNAMIC_SCORE_EVALS{$1};
+      ($pos, $neg) = $conf->{$setting} ? ($INFINITY, -$INFINITY) : (0, 0);
+    }
+    $pos{$pri} += $pos; $neg{$pri} += $neg;
+  }
+
+  foreach my $rule (keys %DYNAMIC_SCORE_HITS) {
+    # the setting only exists if the plugin is loaded
+    if ($conf->{$DYNAMIC_SCORE_HITS{$rule}}) {
+      ($late_pos, $late_neg) = ($INFINITY, -$INFINITY);
+    }
+  }
+
+  my $bounds = {
+    priorities => [ sort { $a <=> $b } keys %pos ],
+    pos => \%pos, neg => \%neg,
+    late_pos => $late_pos, late_neg => $late_neg,
+  };
+
+  # conf objects are cloned shallowly, so replace the cache, don't add to it
+  $conf->{shortcircuit_score_bounds} = { %{$cache || {}}, $set => $bounds };
+  return $bounds;
+}
+
 sub have_shortcircuited {
   my ($self, $params) = @_;
   return (exists $params->{permsgstatus}->{shortcircuit_type}) ? 1 : 0;
@@ -485,8 +485,14 @@ sub extract_metadata {
 
   my $msg = $opts->{msg};
 
-  my $body = $msg->get_rendered_body_text_array();
-  $body = join("\n", @{$body});
+  # only the start of the text gets classified, so don't join any more of
+  # the (shared) rendered lines than that
+  my $lines = $msg->get_rendered_body_text_array();
+  my ($last, $joined) = (-1, -1);
+  while ($last < $#{$lines} && $joined <= 10000 + length('Subject:')) {
+    $joined += length($lines->[++$last]) + 1;
+  }
+  my $body = join("\n", @{$lines}[0 .. $last]);
   $body =~ s/^Subject://i;
 
   my $len = length($body);
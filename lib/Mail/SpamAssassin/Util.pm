@@ -81,6 +81,7 @@ use POSIX qw(:sys_wait_h WIFEXITED WIFSIGNALED WIFSTOPPED WEXITSTATUS
 ###########################################################################
 
 use constant HAS_MIME_BASE64 => eval { require MIME::Base64; };
+use constant HAS_MIME_QUOTEDPRINT => eval { require MIME::QuotedPrint; };
 use constant RUNNING_ON_WINDOWS => ($^O =~ /^(?:mswin|dos|os2)/oi);
 
 # These are not implemented on windows (see bug 6798 and 6470)
@@ -681,6 +682,41 @@ sub base64_decode {
   local $_ = shift;
   my $decoded_length = shift;
 
+  # the common case is a well-formed part: base64 characters and line
+  # breaks only, with padding at the very end.  MIME::Base64 skips the line
+  # breaks itself, so don't copy a large attachment around removing them
+  # first; just count the characters, which is much cheaper.
+  if (HAS_MIME_BASE64) {
+    if (defined $decoded_length) {
+      # only the first few bytes are wanted, so only look at as much of the
+      # encoded text as is needed for those; if that's clean, it's enough
+      my $want = 4 * (int($decoded_length/3) + 1);
+      for (my $len = $want + ($want >> 4) + 4; ; $len *= 2) {
+        my $encoded = substr($_, 0, $len);
+        $encoded =~ tr{ \t\r\n\f}{}d;
+        if (length($encoded) >= $want) {
+          $encoded = substr($encoded, 0, $want);
+          if (!($encoded =~ tr{A-Za-z0-9+/}{}c)) {
+            my $decoded = MIME::Base64::decode_base64($encoded);
+            return substr $decoded, 0, $decoded_length;
+          }
+          last;
+        }
+        last if $len >= length($_);
+      }
+    }
+    else {
+      my $b64_length = tr{A-Za-z0-9+/=}{};
+      my $padding = index($_, '=');
+      if ($b64_length >= 4 && $b64_length % 4 == 0 &&
+          $b64_length + tr{ \t\r\n\f}{} == length($_) &&
+          ($padding < 0 || substr($_, $padding) !~ /[^=\s]/))
+      {
+        return MIME::Base64::decode_base64($_);
+      }
+    }
+  }
+
   s/\s+//g;
   if (HAS_MIME_BASE64 && (length($_) % 4 == 0) &&
       m|^(?:[A-Za-z0-9+/=]{2,}={0,2})$|s)
@@ -724,7 +760,18 @@ sub base64_decode {
 sub qp_decode {
   local $_ = shift;
 
+  return $_  if index($_, '=') < 0;  # nothing to decode
   s/\=\r?\n//gs;
+
+  # MIME::QuotedPrint decodes the escapes in C, but it also strips trailing
+  # whitespace, handles CRs and takes another "=\n" for a soft line break;
+  # only let it do text where none of that makes a difference
+  if (HAS_MIME_QUOTEDPRINT && !utf8::is_utf8($_) && tr/\r// == 0 &&
+      index($_, "=\n") < 0 && !/[ \t]$/m)
+  {
+    return MIME::QuotedPrint::decode_qp($_);
+  }
+
   s/\=([0-9a-fA-F]{2})/chr(hex($1))/ge;
   return $_;
 }
@@ -1682,6 +1729,148 @@ sub make_qr {
   return qr/$re/;
 }
 
+# Find a string which must appear, in lower case, in the lower-cased text
+# for the regexp to match: the longest run of plain characters which are
+# not inside a group, not optional and not part of a top-level alternation.
+# Returns undef if there is no such string, if it is shorter than
+# $min_length (default 3), or if the regexp uses anything this simple
+# reading cannot account for.  Takes the rule with its delimiters,
+# e.g. "/\bviagra\b/i" gives "viagra".
+sub regexp_required_literal {
+  my ($rule, $min_length) = @_;
+  $min_length = 3  if !defined $min_length;
+
+  my $re = regexp_remove_delimiters($rule);
+  return if !defined $re;
+
+  # stay away from anything where lc() and the regexp engine could
+  # disagree on case, and from extended syntax
+  return if $re =~ /[^\x00-\x7f]/;
+  return if $re =~ /\(\?[a-z^-]*x/;
+
+  $re =~ s/^\(\?[a-z]*\)//;
+
+  my @runs;
+  my $run = '';
+  my $pos = 0;
+  my $len = length($re);
+
+  while ($pos < $len) {
+    my $c = substr($re, $pos, 1);
+    my $literal;
+
+    if ($c eq '\\') {
+      my $next = substr($re, $pos+1, 1);
+      return if $next eq '';
+      if ($next =~ /[A-Za-z0-9]/) {
+        # \s, \b, \x41, \040, \cM, \N{U+41}, \pL, \1 etc. are not plain
+        # characters; step over the whole escape, so that the rest of it
+        # isn't taken for literal text
+        substr($re, $pos+1) =~ /^(x\{[^}]*\}|x[0-9A-Fa-f]{0,2}|c.|[0-9]+|
+                                  g-?[0-9]+|k<[^>]*>|k'[^']*'|
+                                  [A-Za-z]\{[^}]*\}|[pP][A-Za-z]|[A-Za-z])/sx
+          or return;
+        $pos += 1 + length($1);
+      } else {
+        $literal = $next;
+        $pos += 2;
+      }
+    }
+    elsif ($c eq '[') {
+      my $end = _regexp_skip_class($re, $pos);
+      return if !defined $end;
+      $pos = $end;
+    }
+    elsif ($c eq '(') {
+      my $end = _regexp_skip_group($re, $pos);
+      return if !defined $end;
+      $pos = $end;
+    }
+    elsif ($c eq '|') {
+      return;   # top-level alternation
+    }
+    elsif ($c =~ /[.^\$]/) {
+      $pos++;
+    }
+    elsif ($c =~ /[)*+?{}\]]/) {
+      return;   # stray quantifier or bracket, don't try to understand it
+    }
+    else {
+      $literal = $c;
+      $pos++;
+    }
+
+    # what follows the atom?
+    my $min = 1;
+    my $repeats = 0;
+    my $q = substr($re, $pos, 1);
+    if ($q eq '?' || $q eq '*') {
+      $min = 0; $pos++;
+    } elsif ($q eq '+') {
+      $repeats = 1; $pos++;
+    } elsif ($q eq '{') {
+      return if substr($re, $pos) !~ /^(\{(\d+)(?:,\d*)?\})/;
+      $min = $2; $repeats = 1;
+      $pos += length($1);
+    }
+    if ($repeats || $min == 0) {
+      # skip lazy and possessive modifiers
+      $pos++ if substr($re, $pos, 1) =~ /[?+]/;
+    }
+
+    if (!defined $literal || $min == 0) {
+      push(@runs, $run) if $run ne '';
+      $run = '';
+      next;
+    }
+
+    $run .= $literal;
+    if ($repeats) {
+      push(@runs, $run);
+      $run = '';
+    }
+  }
+  push(@runs, $run) if $run ne '';
+
+  my ($best) = sort { length($b) <=> length($a) } @runs;
+  return if !defined $best || length($best) < $min_length;
+  return lc untaint_var($best);
+}
+
+# return the position after the character class starting at $pos
+sub _regexp_skip_class {
+  my ($re, $pos) = @_;
+  $pos++;
+  $pos++ if substr($re, $pos, 1) eq '^';
+  $pos++ if substr($re, $pos, 1) eq ']';
+  while ($pos < length($re)) {
+    my $c = substr($re, $pos, 1);
+    if ($c eq '\\') { $pos += 2; next; }
+    return $pos+1 if $c eq ']';
+    $pos++;
+  }
+  return;
+}
+
+# return the position after the group starting at $pos
+sub _regexp_skip_group {
+  my ($re, $pos) = @_;
+  my $depth = 0;
+  while ($pos < length($re)) {
+    my $c = substr($re, $pos, 1);
+    if ($c eq '\\') { $pos += 2; next; }
+    if ($c eq '[') {
+      $pos = _regexp_skip_class($re, $pos);
+      return if !defined $pos;
+      next;
+    }
+    $depth++ if $c eq '(';
+    return $pos+1 if $c eq ')' && --$depth == 0;
+    $pos++;
+  }
+  return;
+}
+
 ###########################################################################
 
 sub get_my_locales {
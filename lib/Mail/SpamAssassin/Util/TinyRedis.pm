@@ -42,6 +42,7 @@ sub new {
   my $self = bless { args => {%args} }, $class;
   my $outbuf = ''; $self->{outbuf} = \$outbuf;
   $self->{batch_size} = 0;
+  $self->{unread_replies} = 0;
   $self->{server} = $args{server} || $args{sock} || '127.0.0.1:6379';
   $self->{on_connect} = $args{on_connect};
   return if !$self->connect;
@@ -64,6 +65,7 @@ sub connect {
   my $self = $_[0];
 
   $self->disconnect;
+  $self->{unread_replies} = 0;  # those were for the old session
   my $sock;
   my $server = $self->{server};
   if ($server =~ m{^/}) {
@@ -185,6 +187,7 @@ sub _write_buff {
 sub call {
   my $self = shift;
 
+  $self->_discard_replies  if $self->{unread_replies};
   my $buff = '*' . scalar(@_) . "\015\012";
   $buff .= '$' . length($_) . "\015\012" . $_ . "\015\012"  for @_;
 
@@ -212,6 +215,7 @@ sub b_results {
   my $self = $_[0];
   my $batch_size = $self->{batch_size};
   return if !$batch_size;
+  $self->_discard_replies  if $self->{unread_replies};
   my $bufref = $self->{outbuf};
   $self->_write_buff($bufref);
   $$bufref = ''; $self->{batch_size} = 0;
@@ -219,4 +223,35 @@ sub b_results {
   $self->_response($batch_size);
 }
 
+# Send a batch of commands without waiting for their replies, for
+# callers which don't care about the outcome.  The replies are read
+# and dropped before the next call or batch is sent.
+#
+sub b_send {
+  my $self = $_[0];
+  my $batch_size = $self->{batch_size};
+  return if !$batch_size;
+  $self->_discard_replies  if $self->{unread_replies};
+  my $bufref = $self->{outbuf};
+  $self->_write_buff($bufref);
+  $$bufref = ''; $self->{batch_size} = 0;
+  $self->{unread_replies} = $batch_size;
+  1;
+}
+
+# Read and drop replies to commands sent by b_send.  These must be out
+# of the way before anything new is written, as _write_buff treats any
+# readable input as a sign of a closed connection.
+#
+sub _discard_replies {
+  my $self = $_[0];
+  my $cnt = $self->{unread_replies};
+  $self->{unread_replies} = 0;
+  local($/) = "\015\012";
+  for (1 .. $cnt) {
+    last if !$self->{sock};  # lost the session, nothing more to read
+    eval { $self->_response(1); 1 };  # error replies are of no interest
+  }
+}
+
 1;
@@ -0,0 +1,85 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("bayes_atime_histogram");
+use Test;
+
+use constant TEST_ENABLED => eval { require DB_File; };
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => (TEST_ENABLED ? 14 : 0);
+};
+
+exit unless TEST_ENABLED;
+
+tstlocalrules ("
+        bayes_learn_to_journal 0
+");
+
+use Mail::SpamAssassin;
+
+my $sa = create_saobj();
+$sa->init();
+
+my $store = $sa->call_plugins("learner_get_implementation")->{store};
+ok($store->tie_db_writable());
+ok($store->{atime_histogram});
+
+# the middle of an hour, so every atime below sits well inside its bucket
+my $now = 3600 * 400000 + 1800;
+
+sub bucket_count {
+  my ($atime) = @_;
+  my $bucket = int($atime / $store->ATIME_BUCKET_SIZE);
+  return $store->{db_toks}->{
+    $Mail::SpamAssassin::BayesStore::DBM::ATIME_BUCKET_MAGIC_PREFIX.$bucket} || 0;
+}
+
+# new tokens are counted in their atime's bucket
+$store->tok_put('aaaaa', 1, 0, $now - 36000);
+$store->tok_put('bbbbb', 1, 0, $now - 36000);
+$store->tok_put('ccccc', 0, 1, $now - 3600);
+$store->tok_put('ddddd', 0, 1, $now);
+ok(bucket_count($now - 36000), 2);
+ok(bucket_count($now - 3600), 1);
+ok(bucket_count($now), 1);
+
+# a token moves between buckets when its atime does, but not within one
+$store->tok_put('bbbbb', 2, 0, $now);
+$store->tok_put('ddddd', 0, 2, $now + 60);
+ok(bucket_count($now - 36000), 1);
+ok(bucket_count($now), 2);
+
+# and leaves its bucket when it is deleted
+$store->tok_put('ccccc', 0, 0, $now);
+ok(bucket_count($now - 3600), 0);
+ok(bucket_count($now), 2);
+
+# with deltas of 4, 8 and 16 hours, only 'aaaaa' is old enough, and only
+# for the first two; the full scan must agree
+my %delta = $store->calculate_expire_delta($now, 4*3600, 4);
+ok(join(' ', map { "$_=$delta{$_}" } sort keys %delta), "1=1 2=1");
+
+$store->{atime_histogram} = 0;
+my %scanned = $store->calculate_expire_delta($now, 4*3600, 4);
+$store->{atime_histogram} = 1;
+ok(join(' ', map { "$_=$scanned{$_}" } sort keys %scanned), "1=1 2=1");
+
+# a db with nothing old enough gets an empty answer from the histogram,
+# not a fall back to scanning every token
+my $young = $store->_calculate_expire_delta_from_histogram($now, 12*3600, 4);
+ok(defined $young && ref $young eq 'HASH');
+ok(!%{$young});
+%delta = $store->calculate_expire_delta($now, 12*3600, 4);
+ok(!%delta);
+
+$store->untie_db();
+$sa->finish();
@@ -0,0 +1,66 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("bayes_journal_sync");
+use Test;
+
+use constant TEST_ENABLED => eval { require DB_File; };
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => (TEST_ENABLED ? 6 : 0);
+};
+
+exit unless TEST_ENABLED;
+
+tstlocalrules ("
+        bayes_learn_to_journal 1
+");
+
+use Mail::SpamAssassin;
+
+my $sa = create_saobj();
+$sa->init();
+
+my $store = $sa->call_plugins("learner_get_implementation")->{store};
+ok($store->tie_db_writable());
+$store->untie_db();
+
+# 'aaaaa' is learned, forgotten (and so deleted) and learned again;
+# 'bbbbb' is learned twice
+open(JOURNAL, '>', $store->_get_journal_filename()) or die "journal: $!";
+print JOURNAL map { "$_\n" }
+  "c 1 0 100 ".unpack("H*", "aaaaa"),
+  "c -1 0 200 ".unpack("H*", "aaaaa"),
+  "c 1 0 150 ".unpack("H*", "aaaaa"),
+  "c 1 0 300 ".unpack("H*", "bbbbb"),
+  "c 1 0 310 ".unpack("H*", "bbbbb"),
+  "t 400 ".unpack("H*", "bbbbb"),
+  "n 2 0";
+close(JOURNAL) or die "journal: $!";
+
+my $output = '';
+{
+  local *STDOUT;
+  open(STDOUT, '>', \$output) or die "cannot capture STDOUT: $!";
+  ok($store->sync({ verbose => 1 }));
+}
+
+# one write each for the two tokens, the touch and the spam count
+ok($output =~ /: 4 unique entries \(7 total entries\)/);
+
+ok($store->tie_db_readonly());
+# the same atime replaying the journal one entry at a time would give:
+# the one from after the deletion, not the newest seen before it
+ok(join(' ', $store->tok_get('aaaaa')), "1 0 150");
+ok(join(' ', $store->tok_get('bbbbb')), "2 0 400");
+$store->untie_db();
+
+$sa->finish();
@@ -0,0 +1,107 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("bayes_token_cache");
+use Test;
+
+use constant TEST_ENABLED => eval { require DB_File; };
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => (TEST_ENABLED ? 12 : 0);
+};
+
+exit unless TEST_ENABLED;
+
+tstlocalrules ("
+        bayes_learn_to_journal 0
+        bayes_auto_learn 0
+        bayes_min_spam_num 1
+        bayes_min_ham_num 1
+        bayes_token_cache_size 100000
+        bayes_token_cache_ttl 60
+");
+
+use Mail::SpamAssassin;
+
+my $sa = create_saobj();
+$sa->init();
+
+sub read_mail {
+  my ($file) = @_;
+  open(MAIL, "< $file") or die "cannot read $file: $!";
+  my $raw = do { local $/; <MAIL> };
+  close(MAIL);
+  return $raw;
+}
+
+sub learn {
+  my ($file, $isspam) = @_;
+  my $mail = $sa->parse(read_mail($file));
+  my $status = $sa->learn($mail, undef, $isspam, 0);
+  my $learned = $status->did_learn();
+  $status->finish();
+  $mail->finish();
+  return $learned;
+}
+
+# scan a message, returning the cache hits and lookups it reported
+my $spam = read_mail("data/spam/001");
+sub scan {
+  my $mail = $sa->parse($spam);
+  my $status = $sa->check($mail);
+  my ($item) = grep { /^bayes_cache=/ } $status->get_spamd_result_log_items();
+  $status->finish();
+  $mail->finish();
+  return defined $item && $item =~ /^bayes_cache=(\d+)\/(\d+)$/ ? ($1, $2)
+                                                               : (-1, -1);
+}
+
+sub cache {
+  return $sa->call_plugins("learner_get_implementation")->{token_cache};
+}
+
+ok(learn("data/spam/002", 1));
+ok(learn("data/nice/001", 0));
+
+# the first scan looks everything up, the second finds it all in the cache
+my ($hits, $lookups) = scan();
+ok($lookups > 0 && $hits == 0);
+($hits, $lookups) = scan();
+ok($lookups > 0 && $hits == $lookups);
+
+# tokens which have outlived bayes_token_cache_ttl are looked up again
+$_->[3] -= 120 foreach values %{cache()->{cur}};
+($hits, $lookups) = scan();
+ok($hits == 0);
+($hits, $lookups) = scan();
+ok($hits == $lookups);
+
+# tokens survive being moved to the old generation
+$sa->{conf}->{bayes_token_cache_size} = 10;
+scan();
+ok(!%{cache()->{cur}} && %{cache()->{old}});
+($hits, $lookups) = scan();
+ok($hits == $lookups);
+$sa->{conf}->{bayes_token_cache_size} = 100000;
+
+# learning changes nspam, and so every token's probability: start afresh
+ok(learn("data/spam/003", 1));
+($hits, $lookups) = scan();
+ok($lookups > 0 && $hits == 0);
+($hits, $lookups) = scan();
+ok($hits == $lookups);
+
+# and the cache is only used if it's switched on
+$sa->{conf}->{bayes_token_cache_size} = 0;
+($hits, $lookups) = scan();
+ok($lookups == -1);
+
+$sa->finish();
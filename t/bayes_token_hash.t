@@ -0,0 +1,102 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("bayes_token_hash");
+use Test;
+use Digest::MD5 qw(md5);
+
+use constant TEST_ENABLED => eval { require DB_File; };
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => (TEST_ENABLED ? 14 : 0);
+};
+
+exit unless TEST_ENABLED;
+
+use Mail::SpamAssassin;
+
+open(MAIL,"< data/spam/001");
+my $raw_message = do {
+  local $/;
+  <MAIL>;
+};
+close(MAIL);
+
+my $sa;
+sub getimpl {
+  return $sa->call_plugins("learner_get_implementation");
+}
+
+sub new_saobj {
+  my ($hash) = @_;
+
+  tstlocalrules ("
+        bayes_learn_to_journal 0
+        bayes_token_hash $hash
+  ");
+  $sa = create_saobj();
+  $sa->init();
+}
+
+# is every token of the message in the db, as a spam token?
+sub all_tokens_learned {
+  my $mail = $sa->parse($raw_message);
+  my $toks = getimpl->tokenize($mail, getimpl->get_body_from_msg($mail));
+  my $missing = grep { (getimpl->{store}->tok_get($_))[0] != 1 } keys %{$toks};
+  $mail->finish();
+  return scalar(keys %{$toks}) > 0 && $missing == 0;
+}
+
+# learn with md5 tokens; the db records which hash it was built with
+new_saobj('md5');
+my $mail = $sa->parse($raw_message);
+ok($sa->{bayes_scanner}->learn(1, $mail));
+$mail->finish();
+
+ok(getimpl->{store}->tie_db_readonly());
+ok(getimpl->{store}->token_hash(), 'md5');
+$mail = $sa->parse($raw_message);
+my $toks = getimpl->tokenize($mail, getimpl->get_body_from_msg($mail));
+my ($key, $token) = each %{$toks};
+ok($key, substr(md5($token), -5));
+$mail->finish();
+ok(all_tokens_learned());
+getimpl->{store}->untie_db();
+$sa->finish();
+
+# an existing db keeps its hash, whatever bayes_token_hash now says
+new_saobj('sha1');
+ok(getimpl->{store}->tie_db_readonly());
+ok(getimpl->{store}->token_hash(), 'md5');
+ok(all_tokens_learned());
+getimpl->{store}->untie_db();
+
+# the backup carries the hash, and restoring it brings the hash back
+# even though the config asks for sha1
+my $backup = "log/bayes_token_hash.backup";
+open(my $save_stdout, '>&', \*STDOUT) or die "cannot dup STDOUT: $!";
+open(STDOUT, '>', $backup) or die "cannot write $backup: $!";
+my $backed_up = getimpl->{store}->backup_database();
+open(STDOUT, '>&', $save_stdout) or die "cannot restore STDOUT: $!";
+ok($backed_up);
+
+open(BACKUP, "< $backup") or die "cannot read $backup: $!";
+my @hash_lines = grep { /\ttoken_hash$/ } <BACKUP>;
+close(BACKUP);
+ok(join('', @hash_lines), "v\tmd5\ttoken_hash\n");
+
+ok(getimpl->{store}->clear_database());
+ok(getimpl->{store}->restore_database($backup, 0));
+
+ok(getimpl->{store}->tie_db_readonly() && getimpl->{store}->token_hash() eq 'md5');
+ok(all_tokens_learned());
+getimpl->{store}->untie_db();
+$sa->finish();
@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("bayes_tokenize");
+use Test;
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => 10;
+};
+
+BEGIN {
+  eval { require Digest::SHA; import Digest::SHA qw(sha1); 1 }
+  or do { require Digest::SHA1; import Digest::SHA1 qw(sha1) }
+}
+
+use strict;
+use Mail::SpamAssassin;
+
+my $sa = create_saobj();
+$sa->init();
+
+sub getimpl {
+  return $sa->call_plugins("learner_get_implementation");
+}
+ok(getimpl && getimpl->{store});
+
+# known _tokenize_line() output per region; stop-list words are dropped,
+# body tokens are decomposed, long header tokens are turned into skips
+my @cases = (
+  [ 1, '', 'Able to see the Information at http://www.Example.com/x today!',
+    'UD:www.Example.com UD:Example.com UD:com wwwExamplecom www.example.com wwwexamplecom www.Example.com today today!' ],
+  [ 1, 'I*:', 'Contact foo@bar.example.com for $31,000,000...now',
+    'I*:contact U*foo D*bar.example.com D*example.com D*com I*:sk:foobar I*:sk:foo@bar I*:31000000 I*:$31,000,000' ],
+  [ 0, 'HFrom:', 'Your Friend <FRIEND@Example.NET>',
+    'HFrom:Friend HFrom:sk:FRIEND@' ],
+  [ 1, '', "Wait---really, YOU'RE the BEST",
+    'wait really best BEST' ],
+  [ 2, '', 'http://Www.Example.co.uk/path',
+    'UD:Www.Example.co.uk UD:Example.co.uk UD:co.uk UD:uk WwwExamplecouk www.example.co.uk wwwexamplecouk Www.Example.co.uk path' ],
+  [ 1, '', 'Supercalifragilisticexpialidocious',
+    'sk:superca' ],
+  # the stop-list applies to the tokens as split, not to what decomposing
+  # them gives
+  [ 1, 'I*:', 'The information and YOUR information!',
+    'I*:information I*:information!' ],
+);
+
+foreach my $case (@cases) {
+  my ($region, $prefix, $line, $expected) = @{$case};
+  my $got = join(' ', getimpl->_tokenize_line($line, $prefix, $region));
+  ok($got eq $expected) or warn "got: [$got] expected: [$expected]\n";
+}
+
+# every token from the test corpus is keyed by the low 40 bits of its SHA1
+my ($badkey, $ntoks) = (0, 0);
+foreach my $file (<data/spam/0*>, <data/nice/0*>) {
+  open(MAIL, "< $file") or die "cannot open $file: $!";
+  my $mail = $sa->parse(\*MAIL);
+  close(MAIL);
+
+  my $toks = getimpl->tokenize($mail, getimpl->get_body_from_msg($mail));
+  while (my ($key, $token) = each %{$toks}) {
+    $ntoks++;
+    $badkey++  if $key ne substr(sha1($token), -5);
+  }
+  $mail->finish();
+}
+ok($ntoks > 0);
+ok(!$badkey);
@@ -0,0 +1,63 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("header_prefilter");
+use Test; BEGIN { plan tests => 18 };
+
+# ---------------------------------------------------------------------------
+
+# several rules on each header, so that they are run behind a single scan
+# for the strings they need
+
+%patterns = (
+
+        q{ PREF_SUBJ_WORD }, 'word',
+        q{ PREF_SUBJ_PREFIX }, 'prefix',
+        q{ PREF_SUBJ_CASE }, 'case',
+        q{ PREF_SUBJ_NEG }, 'negated',
+        q{ PREF_FROM_ADDR }, 'addr',
+        q{ PREF_XM_UNSET }, 'unset',
+        q{ PREF_SUBJ_HEX }, 'hex escape',
+        q{ PREF_SUBJ_HEX_BRACES }, 'hex escape in braces',
+        q{ PREF_SUBJ_OCTAL }, 'octal escape',
+        q{ PREF_SUBJ_CONTROL }, 'control escape',
+        q{ PREF_SUBJ_NAMED }, 'named escape',
+        q{ PREF_SUBJ_PROP }, 'property escape',
+        q{ PREF_SUBJ_NOT_PROP }, 'negated property escape',
+
+);
+%anti_patterns = (
+
+        q{ PREF_SUBJ_MISS }, 'miss',
+        q{ PREF_SUBJ_EXACT }, 'exact case',
+        q{ PREF_XM_A }, 'missing header',
+        q{ PREF_XM_B }, 'missing header 2',
+
+);
+tstlocalrules (q{
+
+        header PREF_SUBJ_WORD    Subject =~ /\bfree\b/i
+        header PREF_SUBJ_PREFIX  Subject =~ /fre{2}!/i
+        header PREF_SUBJ_CASE    Subject =~ /THERE yours/i
+        header PREF_SUBJ_EXACT   Subject =~ /THERE yours/
+        header PREF_SUBJ_MISS    Subject =~ /not in it/
+        header PREF_SUBJ_NEG     Subject !~ /not in it/
+        header PREF_FROM_ADDR    From:addr =~ /sb123456789\@yahoo\.com/
+        header PREF_FROM_OTHER   From:addr =~ /nobody\@example\.com/
+        header PREF_XM_A         X-Mailer =~ /outlook/i
+        header PREF_XM_B         X-Mailer =~ /mozilla/i
+        header PREF_XM_UNSET     X-Mailer =~ /none at all/ [if-unset: none at all]
+
+        # escapes are not literal text (\c` is a space)
+        header PREF_SUBJ_HEX         Subject =~ /There\x20yours/
+        header PREF_SUBJ_HEX_BRACES  Subject =~ /There\x{20}yours/
+        header PREF_SUBJ_OCTAL       Subject =~ /There\040yours/
+        header PREF_SUBJ_CONTROL     Subject =~ /for\c`FREE/
+        header PREF_SUBJ_NAMED       Subject =~ /There\N{U+20}yours\o{40}for/
+        header PREF_SUBJ_PROP        Subject =~ /\pLhere yours/
+        header PREF_SUBJ_NOT_PROP    Subject =~ /\PLyours/
+
+});
+
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
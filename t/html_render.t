@@ -0,0 +1,66 @@
+#!/usr/bin/perl -w
+
+BEGIN {
+  if (-e 't/test_dir') { # if we are running "t/rule_tests.t", kluge around ...
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {            # running from test directory, not ..
+    unshift(@INC, '../blib/lib');
+    unshift(@INC, '../lib');
+  }
+}
+
+use strict;
+use Test;
+use Mail::SpamAssassin::HTML;
+
+plan tests => 7;
+
+sub render {
+  my ($html) = @_;
+
+  my $parser = Mail::SpamAssassin::HTML->new();
+  $parser->parse($html);
+  return $parser;
+}
+
+# compare rendered text without worrying about exactly how whitespace is
+# collapsed between text chunks
+sub text {
+  my ($parser, @options) = @_;
+
+  my $text = $parser->get_rendered_text(@options);
+  $text =~ s/\s+/ /g;
+  $text =~ s/^ //;
+  $text =~ s/ $//;
+  return $text;
+}
+
+# invisibility is worked out once per text style, so make sure nested styles
+# don't inherit their parent's answer and closing them restores it
+my $p = render('<body bgcolor="white">shown '.
+  '<font color="white">hidden <font color="red">red</font> hidden2</font> '.
+  '<span style="display: none">gone</span> shown2</body>');
+ok(text($p, invisible => 0), "shown red shown2");
+ok(text($p, invisible => 1), "hidden hidden2gone");
+ok($p->get_results()->{font_low_contrast});
+
+# a big enough <font> makes text visible again
+$p = render('<font size="1">tiny <font size="+3">big</font></font>');
+ok(text($p, invisible => 0), "big");
+
+# whitespace inserted by block elements
+$p = render("one<br>two<p>three</p><li>four<h2>five</h2>");
+ok($p->get_rendered_text(), "one\ntwo\n\nthree\n\n four five ");
+
+# URIs from each kind of attribute, <base> included
+$p = render('<body background="http://example.com/bg.gif">'.
+  '<base href="http://example.com/dir/index.html">'.
+  '<a href="a.html">a</a><img src="i.gif"><form action="/post">'.
+  '<iframe src=" http://example.net/f ">');
+ok(join(" ", sort @{ $p->get_results()->{uri} }),
+  "/post a.html http://example.com/bg.gif http://example.com/dir/index.html ".
+  "http://example.net/f i.gif");
+ok(join(" ", sort keys %{ $p->get_results()->{uri_detail}{'a.html'}{types} }),
+  "a");
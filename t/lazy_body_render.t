@@ -0,0 +1,72 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("lazy_body_render");
+use Test;
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => 7;
+};
+
+use File::Path;
+use Mail::SpamAssassin;
+
+# ---------------------------------------------------------------------------
+# the body is only rendered once a rule needs it; $pms->{html} is set then
+
+open(MAIL, "< data/spam/006") or die "cannot read data/spam/006: $!";
+my $raw = do { local $/; <MAIL> };
+close(MAIL);
+
+rmtree("log/lazy_body_rules");
+mkdir("log/lazy_body_rules", 0755);
+
+sub check_with_rules {
+  my ($rules) = @_;
+
+  tstlocalrules ("
+        loadplugin Mail::SpamAssassin::Plugin::Check
+        loadplugin Mail::SpamAssassin::Plugin::HTMLEval
+
+        header LAZY_SUBJ      Subject =~ /yellow stained teeth/
+        $rules
+  ");
+  my $sa = create_saobj({ rules_filename => 'log/lazy_body_rules' });
+  $sa->init(0);
+
+  my $mail = $sa->parse($raw);
+  my $status = $sa->check($mail);
+  my %result = (
+    tests => join(',', sort split(/,/, $status->get_names_of_tests_hit())),
+    rendered => exists $mail->{text_rendered},
+    html => $status->{html},
+  );
+  $status->finish();
+  $mail->finish();
+  $sa->finish();
+  return \%result;
+}
+
+# header rules only: the HTML part is never rendered
+my $result = check_with_rules('');
+ok($result->{tests}, 'LAZY_SUBJ');
+ok(!$result->{rendered});
+ok(!defined $result->{html});
+
+# an HTML eval rule still gets to see what rendering the HTML found
+$result = check_with_rules("
+        body LAZY_HTML        eval:html_tag_exists('html')
+        body LAZY_NO_TAG      eval:html_tag_exists('frameset')
+");
+ok($result->{tests}, 'LAZY_HTML,LAZY_SUBJ');
+ok($result->{rendered});
+ok(ref $result->{html} eq 'HASH');
+ok(exists $result->{html}->{inside}->{html});
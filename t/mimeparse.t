@@ -107,7 +107,7 @@ my $sa = Mail::SpamAssassin->new({
     dont_copy_prefs   => 1,
 });
 
-my $numtests = 5;
+my $numtests = 10;
 while ( my($k,$v) = each %files ) {
   $numtests += @{$v};
 }
@@ -182,3 +182,80 @@ $mail = $sa->parse(\@msg);
 $subject = $mail->get_header("Subject");
 $mail->finish();
 ok($subject eq "a b mem_brain =?  invalid ?=\n");
+
+# malformed parts: a part without mime headers, one without a blank line
+# after them, a header-only part (whose header never ends, so it's lost),
+# and an epilogue after the end boundary
+@msg = ("Content-Type: multipart/mixed; boundary=XX\n", "\n",
+        "preamble\n",
+        "--XX\n", "no headers here\n",
+        "--XX\n", "Content-Type: text/plain\n", "body right after\n", "\n",
+        "--XX\n", "Content-Type: text/html\n", " ; charset=us-ascii\n",
+        "--XX--\n", "epilogue\n");
+$mail = $sa->parse(\@msg, 1);
+ok(join("\n", $mail->content_summary()) eq
+   "multipart/mixed\ntext/plain\ntext/plain\ntext/plain" &&
+   $mail->{missing_mime_headers} &&
+   $mail->{missing_mime_head_body_separator} &&
+   $mail->{mime_epilogue_exists} &&
+   join('|', map { $_->decode() } $mail->find_parts(qr/./,1)) eq
+     "no headers here|body right after\n|");
+$mail->finish();
+
+# a part without an end boundary keeps its last line, and a long series
+# of blank lines is squashed into one
+@msg = ("Content-Type: multipart/mixed; boundary=XX\n", "\n",
+        "--XX\n", "Content-Type: text/plain\n", "\n",
+        "a\n", ("\n") x 20, "b\n", "last");
+$mail = $sa->parse(\@msg, 1);
+ok(($mail->find_parts(qr/./,1))[0]->decode() eq "a\n\nb\nlast" &&
+   !$mail->{mime_epilogue_exists});
+$mail->finish();
+
+# small parts of types we don't use stay in memory, large ones go to a
+# temp file; either way they decode the same
+@msg = ("Content-Type: multipart/mixed; boundary=XX\n", "\n",
+        "--XX\n", "Content-Type: image/gif\n", "\n", "GIF89a small\n",
+        "--XX\n", "Content-Type: image/gif\n", "\n", ("GIF89a large\n") x 10000,
+        "--XX--\n");
+$mail = $sa->parse(\@msg, 1);
+my @gifs = $mail->find_parts(qr/./,1);
+ok(ref $gifs[0]->{raw} ne 'GLOB' && ref $gifs[1]->{raw} eq 'GLOB' &&
+   $gifs[0]->decode() eq "GIF89a small" &&
+   $gifs[1]->decode() eq ("GIF89a large\n" x 9999)."GIF89a large");
+$mail->finish();
+
+# attachments are decoded in full only as far as the decode budget goes;
+# text parts and limited decodes don't count against it
+my $gif = "R0lGODlh" . ("QUJD" x 33) . "\n";    # "GIF89a" and 99 more bytes
+@msg = ("Content-Type: multipart/mixed; boundary=XX\n", "\n",
+        "--XX\n", "Content-Type: text/plain\n", "\n", ("text\n") x 50,
+        "--XX\n", "Content-Type: image/gif\n",
+        "Content-Transfer-Encoding: base64\n", "\n", $gif,
+        "--XX\n", "Content-Type: image/gif\n",
+        "Content-Transfer-Encoding: base64\n", "\n", $gif,
+        "--XX--\n");
+$mail = Mail::SpamAssassin::Message->new({ message=>\@msg, parsenow=>1,
+                                           decode_budget=>150 });
+my ($text, @budget_gifs) = $mail->find_parts(qr/./,1);
+ok(length $budget_gifs[1]->decode(13) == 13 &&
+   length $text->decode() == 249 &&
+   length $budget_gifs[0]->decode() == 105 &&
+   !$budget_gifs[0]->{decode_truncated} &&
+   length $budget_gifs[1]->decode() == 45 &&
+   $budget_gifs[1]->{decode_truncated} &&
+   $budget_gifs[1]->decode() eq substr($budget_gifs[0]->decode(), 0, 45));
+$mail->finish();
+
+# without any invisible text, the rendered and visible text are built once
+# and shared; overlong lines are split, at a space where there is one
+@msg = ("Subject: long lines\n", "\n", "short\n", "\n",
+        ("word " x 500), "\n", "\n", ("x" x 3000), "\n");
+$mail = $sa->parse(\@msg, 1);
+my $rendered = $mail->get_rendered_body_text_array();
+ok($rendered == $mail->get_visible_rendered_body_text_array() &&
+   !@{ $mail->get_invisible_rendered_body_text_array() } &&
+   join(",", map { length } @{$rendered}) eq "11,6,2045,456,2048,953" &&
+   join("", @{$rendered}) eq "long lines\nshort\n".("word " x 500)."\n".
+                             ("x" x 3000)." ");
+$mail->finish();
@@ -0,0 +1,86 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("multi_body_match");
+use Test;
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+    unshift(@INC, '../lib');
+  }
+
+  plan tests => 26;
+};
+
+use Mail::SpamAssassin::Util;
+
+# ---------------------------------------------------------------------------
+
+# the required strings found for some typical rules
+my %literals = (
+  '/\bviagra\b/i'                       => 'viagra',
+  '/To Be Removed,? Please/i'           => 'to be removed',
+  '/colou?r\s+free{0,2}dom/'            => 'colo',
+  'm{foo/ba{2,3}r}i'                    => 'foo/ba',
+  '/(?:e?-?mail|message) reached you/'  => ' reached you',
+  '/\$\d+ per day/'                     => ' per day',
+  '/viagra|cialis/i'                    => undef,
+  '/[a-z]{4}\d+/'                       => undef,
+  '/(?x) foo bar baz /'                 => undef,
+  '/free\x20money/'                     => 'money',
+  '/free\x{20}money/'                   => 'money',
+  '/free\040money/'                     => 'money',
+  '/hi\cMworld/'                        => 'world',
+  '/\N{U+41}bcdef/'                     => 'bcdef',
+  '/\o{101}bcdef/'                      => 'bcdef',
+  '/\pLviagra/'                         => 'viagra',
+  '/\PLcheap meds/'                     => 'cheap meds',
+);
+foreach my $rule (sort keys %literals) {
+  my $got = Mail::SpamAssassin::Util::regexp_required_literal($rule);
+  ok((defined $got ? $got : 'undef') eq
+     (defined $literals{$rule} ? $literals{$rule} : 'undef'))
+    or warn "$rule: got ".(defined $got ? "'$got'" : 'undef')."\n";
+}
+
+# ---------------------------------------------------------------------------
+
+%patterns = (
+
+        q{ MULTI_LITERAL }, 'literal',
+        q{ MULTI_LONG }, 'long',
+        q{ MULTI_PREFIX }, 'prefix',
+        q{ MULTI_OVERLAP }, 'overlap',
+        q{ MULTI_NO_LITERAL }, 'no_literal',
+        q{ MULTI_ESCAPE }, 'escape',
+        q{ MULTI_PROP }, 'property',
+
+);
+%anti_patterns = (
+
+        q{ MULTI_MISSING }, 'missing',
+
+);
+tstlocalrules (q{
+
+        loadplugin Mail::SpamAssassin::Plugin::MultiBodyMatch
+
+        body MULTI_LITERAL    /\bUniversal Studios\b/
+        body MULTI_LONG       /free 2 day vip passes/i
+        body MULTI_PREFIX     /\bfree 2 day\b/i
+        body MULTI_OVERLAP    /ee 2 Day VIP/i
+        body MULTI_NO_LITERAL /(?:FREE|GRATIS) \d/
+        body MULTI_MISSING    /\bUniversal Pictures\b/
+        body MULTI_ESCAPE     /FREE\x202 Day/
+        body MULTI_PROP       /\pLREE\PL2 Day/
+
+});
+
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+
@@ -22,7 +22,7 @@ BEGIN {
   if (-e 't/test_dir') { chdir 't'; } 
   if (-e 'test_dir') { unshift(@INC, '../blib/lib'); }
 
-  plan tests => 128;
+  plan tests => 139;
 
 };
 use lib '../lib';
@@ -438,12 +438,56 @@ try_extraction ('
 
 ]);
 
+# ---------------------------------------------------------------------------
+# rawbody, uri and header rules; header rules are grouped by header name,
+# and only the plain "Name =~ /pattern/" form is used
+
+my %casei_params = (
+    base_extract => 1,
+    bases_must_be_casei => 1,
+    bases_can_use_alternations => 0,
+    bases_can_use_quantifiers => 0,
+    bases_can_use_char_classes => 0,
+    bases_split_out_alternations => 1
+);
+
+try_extraction ('
+    rawbody TEST_RAW /<font color=red>/i
+
+', { %casei_params }, [
+
+    '<font color=red>:TEST_RAW,[l=0]',
+], [ ], 'rawbody_0');
+
+try_extraction ('
+    uri TEST_URI /spammer\.example\/offer/i
+
+', { %casei_params }, [
+
+    'spammer.example/offer:TEST_URI,[l=0]',
+], [ ], 'uri_0');
+
+try_extraction ('
+    header TEST_SUBJ Subject =~ /free gift card/i
+    header TEST_SUBJ_NEG Subject !~ /free gift card/i
+    header TEST_SUBJ_UNSET Subject =~ /free gift card/i [if-unset: free gift card]
+    header TEST_FROM From:addr =~ /free gift card/i
+
+', { %casei_params }, [
+
+    'free gift card:TEST_SUBJ,[l=0]',
+], [
+
+    'free gift card:TEST_SUBJ,[l=0] TEST_SUBJ_NEG,[l=0]',
+    'free gift card:TEST_FROM,[l=0] TEST_SUBJ,[l=0]',
+], 'head_Subject_0');
+
 #############################################################################
 
 use Mail::SpamAssassin;
 
 sub try_extraction {
-  my ($rules, $params, $output, $notoutput) = @_;
+  my ($rules, $params, $output, $notoutput, $ruletype) = @_;
 
   my $sa = Mail::SpamAssassin->new({
     rules_filename => "log/test_rules_copy",
@@ -482,7 +526,7 @@ sub try_extraction {
   ok ($sa->lint_rules() == 0) or warn "lint failed: $rules";
 
   my $conf = $sa->{conf};
-  my $ruletype = "body_0";
+  $ruletype ||= "body_0";
   foreach my $key1 (sort keys %{$conf->{base_orig}->{$ruletype}}) {
     print "INPUT: $key1 $conf->{base_orig}->{$ruletype}->{$key1}\n";
   }
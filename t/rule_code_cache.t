@@ -0,0 +1,91 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("rule_code_cache");
+use Test; BEGIN { plan tests => 18 };
+use File::Path;
+
+# ---------------------------------------------------------------------------
+
+rmtree("log/rule_code_cache");
+mkdir("log/rule_code_cache", 0755);
+
+tstlocalrules ('
+
+  rule_code_cache_dir log/rule_code_cache
+
+  body CACHE_BODY       /Congratulations/
+  header __CACHE_HEAD   Subject =~ /\S/
+  meta CACHE_META       __CACHE_HEAD && CACHE_BODY
+
+');
+
+%patterns = (
+  q{ CACHE_BODY }, 'body',
+  q{ CACHE_META }, 'meta',
+);
+
+# the first run generates the code and saves it, the second one loads it
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+ok (-f "log/rule_code_cache/body_0.pl" && -f "log/rule_code_cache/meta_0.pl");
+# nothing is left half-written
+ok (!glob("log/rule_code_cache/*.tmp"));
+
+clear_pattern_counters();
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+
+# a changed rule must not be run from the old code
+tstlocalrules ('
+
+  rule_code_cache_dir log/rule_code_cache
+
+  body CACHE_BODY       /^this is not in the message$/
+  header __CACHE_HEAD   Subject =~ /\S/
+  meta CACHE_META       __CACHE_HEAD && CACHE_BODY
+
+');
+
+%patterns = ();
+%anti_patterns = (
+  q{ CACHE_BODY }, 'body',
+  q{ CACHE_META }, 'meta',
+);
+
+clear_pattern_counters();
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+
+# the cached code gets eval'd, so it is only trusted if nobody else could
+# have written it; plant some code next to the saved key to find out
+sub plant {
+  my ($mode) = @_;
+  unlink("log/rule_code_cache.planted");
+  open(my $in, '<', "log/rule_code_cache/body_0.pl") or die "read: $!";
+  my ($key, @code) = <$in>;
+  close($in);
+  open(my $out, '>', "log/rule_code_cache/body_0.pl") or die "write: $!";
+  print $out $key, "{ open(my \$m, '>', 'log/rule_code_cache.planted'); }\n",
+             @code;
+  close($out) or die "write: $!";
+  chmod($mode, "log/rule_code_cache/body_0.pl");
+}
+
+%patterns = ();
+%anti_patterns = ();
+
+plant(0644);
+ok (sarun ("-L -t < data/spam/001"));
+ok (-f "log/rule_code_cache.planted");
+
+plant(0664);
+ok (sarun ("-L -t < data/spam/001"));
+ok (!-f "log/rule_code_cache.planted");
+# and it was replaced by a file that can be trusted
+ok (((stat("log/rule_code_cache/body_0.pl"))[2] & 07777) == 0644);
+
+plant(0644);
+chmod(0775, "log/rule_code_cache");
+ok (sarun ("-L -t < data/spam/001"));
+ok (!-f "log/rule_code_cache.planted");
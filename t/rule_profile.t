@@ -0,0 +1,32 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("rule_profile");
+use Test; BEGIN { plan tests => 7 };
+
+# ---------------------------------------------------------------------------
+
+tstlocalrules ('
+
+  body PROFILE_BODY     /Congratulations/
+  header PROFILE_HEAD   Subject =~ /^nothing like this$/
+  uri PROFILE_URI       /^http:/
+
+');
+
+unlink("log/rule_profile");
+
+# two runs, adding up in the same file
+ok (sarun ("-L --profile-rules=log/rule_profile < data/spam/001"));
+ok (sarun ("-L --profile-rules=log/rule_profile < data/spam/001"));
+
+%patterns = (
+  q{  PROFILE_URI }, 'uri rule',
+  q{ rules }, 'total',
+);
+ok (sarun ("--profile-report=log/rule_profile", \&patterns_run_cb));
+ok_all_patterns();
+
+# the runs, us/run, hits and %hit columns
+ok ($matched_output =~ /\b2\s+\S+\s+2\s+100\.00\s+PROFILE_BODY\b/);
+ok ($matched_output =~ /\b2\s+\S+\s+0\s+0\.00\s+PROFILE_HEAD\b/);
@@ -31,7 +31,7 @@ BEGIN {
     unshift(@INC, '../blib/lib');
   }
 
-  plan tests => ((TEST_ENABLED && !$RUNNING_ON_WINDOWS) ? 5 : 0);
+  plan tests => ((TEST_ENABLED && !$RUNNING_ON_WINDOWS) ? 6 : 0);
 };
 
 exit unless (TEST_ENABLED && !$RUNNING_ON_WINDOWS);
@@ -119,6 +119,7 @@ $scr_localrules_args = $scr_cf_args = "";      # use the default rules dir, from
 set_rules q{
 
   body FOO /You have been selected to receive/
+  header FOO_SUBJ Subject =~ /yours for free/i
 
 };
 
@@ -126,7 +127,7 @@ set_rules q{
 system("rm -rf $instdir/foo/var/spamassassin/compiled");
 %patterns = (
 
-  q{ check: tests=FOO }, 'FOO'
+  q{ check: tests=FOO,FOO_SUBJ }, 'FOO'
 
 );
 ok sarun ("-D -Lt < $cwd/data/spam/001 2>&1", \&patterns_run_cb);
@@ -139,7 +140,8 @@ system_or_die "$instdir/foo/bin/sa-compile --keep-tmps";  # --debug
 %patterns = (
 
   q{ able to use 1/1 'body_0' compiled rules }, 'able-to-use',
-  q{ check: tests=FOO }, 'FOO'
+  q{ able to use 1/1 'head_Subject_0' compiled rules }, 'able-to-use-head',
+  q{ check: tests=FOO,FOO_SUBJ }, 'FOO'
 
 );
 $scr = "$instdir/foo/bin/spamassassin";
@@ -0,0 +1,47 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("sa_learn_jobs");
+use Test;
+
+use constant TEST_ENABLED => conf_bool('run_long_tests') &&
+                            eval { require DB_File; };
+
+BEGIN {
+  if (-e 't/test_dir') {
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {
+    unshift(@INC, '../blib/lib');
+  }
+
+  plan tests => ((TEST_ENABLED && !$RUNNING_ON_WINDOWS) ? 8 : 0);
+};
+
+exit unless (TEST_ENABLED && !$RUNNING_ON_WINDOWS);
+
+tstlocalrules ("
+        bayes_learn_to_journal 0
+");
+
+my ($learned, $examined);
+sub check_learned {
+  my $output = join('', <IN>);
+  ($learned, $examined) =
+    ($output =~ /Learned tokens from (\d+) message\(s\) \((\d+) message\(s\) examined\)/);
+}
+
+# the spam corpus, learned by three workers and synced at the end
+ok(salearnrun("-j 3 --spam data/spam", \&check_learned));
+ok($examined > 1);
+ok($learned > 0);
+ok(!-s 'log/user_state/bayes_journal');
+
+%patterns = ( "$learned 0  non-token data: nspam" => 'spam in database' );
+ok(salearnrun("--dump magic", \&patterns_run_cb));
+ok_all_patterns();
+
+# the workers see what has been learned already
+ok(salearnrun("-j 2 --spam data/spam", \&check_learned));
+ok($learned == 0);
@@ -2,7 +2,7 @@
 
 use lib '.'; use lib 't';
 use SATest; sa_t_init("shortcircuit");
-use Test; BEGIN { plan tests => 18 };
+use Test; BEGIN { plan tests => 34 };
 
 # ---------------------------------------------------------------------------
 
@@ -66,3 +66,101 @@ ok_all_patterns();
 );
 ok (sarun ("-L -t < data/nice/001", \&patterns_run_cb));
 ok_all_patterns();
+
+# ---------------------------------------------------------------------------
+
+tstlocalrules ('
+
+  add_header all Status "_YESNO_, score=_SCORE_ required=_REQD_ tests=_TESTS_ shortcircuit=_SCTYPE_ autolearn=_AUTOLEARN_ version=_VERSION_"
+
+  shortcircuit_score_bound 1
+  bayes_auto_learn 0
+
+  # AWL makes up its own score, so it would keep the bound open
+  use_auto_whitelist 0
+
+  # hits spam/001; nothing after it can bring the score under 5
+  body SC_BOUND_SPAM    /Congratulations/
+  priority SC_BOUND_SPAM -100
+  score SC_BOUND_SPAM   20
+
+  # hits nice/001; nothing after it can bring the score over 5
+  header SC_BOUND_HAM   X-Mailer =~ /Evolution/
+  priority SC_BOUND_HAM -100
+  score SC_BOUND_HAM    -10
+
+  # hits both, but need not be run
+  header SC_BOUND_LATE  Received =~ /\bfrom\b/
+  priority SC_BOUND_LATE 500
+  score SC_BOUND_LATE   -3
+
+');
+
+%patterns = (
+  q{ SC_BOUND_SPAM }, 'hit',
+  q{ shortcircuit=spam }, 'sc',
+);
+%anti_patterns = (
+  q{ SC_BOUND_LATE }, 'later rule skipped',
+);
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+
+%patterns = (
+  q{ SC_BOUND_HAM }, 'hit',
+  q{ shortcircuit=ham }, 'sc_ham',
+);
+%anti_patterns = (
+  q{ SC_BOUND_LATE }, 'later rule skipped',
+);
+ok (sarun ("-L -t < data/nice/001", \&patterns_run_cb));
+ok_all_patterns();
+
+# ---------------------------------------------------------------------------
+# PhishTag hits PHISHTAG_TOSS with a score of its own after all the rules,
+# so while it is switched on the outcome is never certain early
+
+tstlocalrules ('
+
+  add_header all Status "_YESNO_, score=_SCORE_ required=_REQD_ tests=_TESTS_ shortcircuit=_SCTYPE_ autolearn=_AUTOLEARN_ version=_VERSION_"
+
+  shortcircuit_score_bound 1
+  bayes_auto_learn 0
+  use_auto_whitelist 0
+
+  loadplugin Mail::SpamAssassin::Plugin::PhishTag
+  trigger_ratio 10
+
+  body SC_BOUND_SPAM    /Congratulations/
+  priority SC_BOUND_SPAM -100
+  score SC_BOUND_SPAM   20
+
+  header SC_BOUND_HAM   X-Mailer =~ /Evolution/
+  priority SC_BOUND_HAM -100
+  score SC_BOUND_HAM    -10
+
+  header SC_BOUND_LATE  Received =~ /\bfrom\b/
+  priority SC_BOUND_LATE 500
+  score SC_BOUND_LATE   -3
+
+');
+
+%patterns = (
+  q{ SC_BOUND_SPAM }, 'hit',
+  q{ SC_BOUND_LATE }, 'later rule run',
+);
+%anti_patterns = (
+  q{ shortcircuit=spam }, 'sc',
+);
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+
+%patterns = (
+  q{ SC_BOUND_HAM }, 'hit',
+  q{ SC_BOUND_LATE }, 'later rule run',
+);
+%anti_patterns = (
+  q{ shortcircuit=ham }, 'sc_ham',
+);
+ok (sarun ("-L -t < data/nice/001", \&patterns_run_cb));
+ok_all_patterns();
@@ -0,0 +1,75 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("skip_unneeded_subrules");
+use Test; BEGIN { plan tests => 13 };
+
+# ---------------------------------------------------------------------------
+
+my $rules = q{
+
+  add_header all Subtests _SUBTESTS_
+
+  header __SKIP_FROM_MISS  From =~ /nobody-sends-from-here/
+  body   __SKIP_BODY_A     /Universal Studios/
+  meta   SKIP_AND_MISS     __SKIP_FROM_MISS && __SKIP_BODY_A
+  score  SKIP_AND_MISS     0.1
+
+  header __SKIP_SUBJ       Subject =~ /yours for free/i
+  body   __SKIP_BODY_B     /VIP Passes/
+  meta   SKIP_AND_HIT      __SKIP_SUBJ && __SKIP_BODY_B
+  score  SKIP_AND_HIT      0.1
+
+  body   __SKIP_BODY_C     /Congratulations/
+  meta   SKIP_OR_HIT       __SKIP_SUBJ || __SKIP_BODY_C
+  score  SKIP_OR_HIT       0.1
+
+  body   __SKIP_BODY_D     /selected to receive/
+  meta   __SKIP_INNER      !__SKIP_SUBJ && __SKIP_BODY_D
+  meta   SKIP_NESTED       __SKIP_INNER || __SKIP_FROM_MISS
+  score  SKIP_NESTED       0.1
+
+  body   __SKIP_BODY_E     /Day VIP/
+  meta   SKIP_ARITH        (__SKIP_FROM_MISS + __SKIP_BODY_E) > 0
+  score  SKIP_ARITH        0.1
+
+};
+
+# ---------------------------------------------------------------------------
+
+%patterns = (
+
+        q{ SKIP_AND_HIT }, 'and_hit',
+        q{ SKIP_OR_HIT }, 'or_hit',
+        q{ SKIP_ARITH }, 'arith',
+        q{__SKIP_BODY_B}, 'subrule_needed',
+        q{__SKIP_BODY_E}, 'subrule_arith',
+
+);
+%anti_patterns = (
+
+        q{ SKIP_AND_MISS }, 'and_miss',
+        q{__SKIP_BODY_A}, 'subrule_and_decided',
+        q{__SKIP_BODY_C}, 'subrule_or_decided',
+        q{__SKIP_BODY_D}, 'subrule_nested_decided',
+
+);
+tstlocalrules ($rules . q{
+  skip_unneeded_subrules 1
+});
+
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
+
+# without the option, every subrule is run
+%patterns = (
+
+        q{__SKIP_BODY_A}, 'subrule_and',
+        q{__SKIP_BODY_C}, 'subrule_or',
+
+);
+%anti_patterns = ();
+tstlocalrules ($rules);
+
+ok (sarun ("-L -t < data/spam/001", \&patterns_run_cb));
+ok_all_patterns();
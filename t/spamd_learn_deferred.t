@@ -0,0 +1,74 @@
+#!/usr/bin/perl
+
+use lib '.'; use lib 't';
+use SATest; sa_t_init("spamd_learn_deferred");
+
+use constant TEST_ENABLED => !$SKIP_SPAMD_TESTS && !$SKIP_SETUID_NOBODY_TESTS &&
+                            eval { require DB_File; };
+
+use Test; BEGIN { plan tests => (TEST_ENABLED ? 4 : 0) };
+
+exit unless TEST_ENABLED;
+
+use IO::Socket;
+
+# ---------------------------------------------------------------------------
+# spamd defers auto-learning until it has replied; make sure the learn
+# still happens once the client has its answer
+
+tstlocalrules ('
+body	AUTOLEARNTEST_BODY	/EVOLUTION PREVIEW RELEASE/
+score	AUTOLEARNTEST_BODY	1.5
+
+body    AUTOLEARNTEST_BODY2     /GET SOURCE CODE/
+score   AUTOLEARNTEST_BODY2     1.5
+
+body    AUTOLEARNTEST_BODY3     /RELEASE NOTES/
+score   AUTOLEARNTEST_BODY3     1.5
+
+header  AUTOLEARNTEST_HEAD      From =~ /@/
+score   AUTOLEARNTEST_HEAD      1.5
+
+header  AUTOLEARNTEST_HEAD2     Subject =~ /HC Announce/
+score   AUTOLEARNTEST_HEAD2     1.5
+
+header  AUTOLEARNTEST_HEAD3	Precedence =~ /bulk/
+score	AUTOLEARNTEST_HEAD3	1.5
+
+use_bayes 1
+bayes_auto_learn 1
+bayes_auto_learn_threshold_spam 6.0
+bayes_learn_to_journal 0
+');
+
+start_spamd("-L");
+
+open (MAIL, "data/nice/001") || die $!;
+my $data = do { local $/; <MAIL> };
+close (MAIL);
+
+my $socket = IO::Socket::INET->new(PeerAddr => $spamdhost,
+                                   PeerPort => $spamdport,
+                                   Proto    => "tcp",
+                                   Type     => SOCK_STREAM);
+ok ($socket);
+
+print $socket "CHECK SPAMC/1.2\r\n",
+              "Content-Length: " . length($data) . "\r\n\r\n", $data;
+shutdown($socket, 1);
+
+# like spamc, read the reply up to EOF
+my $reply = do { local $/; <$socket> };
+close ($socket);
+ok ($reply =~ /^Spam: True ;/m);
+
+# the learn happens after the reply, so give the child a moment to finish
+# before stopping spamd
+sleep 2;
+stop_spamd();
+
+%patterns = (
+  q{ 1 0 non-token data: nspam }, 'learned as spam',
+);
+ok (salearnrun ("--dump magic", \&patterns_run_cb));
+ok_all_patterns();
@@ -0,0 +1,55 @@
+#!/usr/bin/perl
+
+BEGIN {
+  if (-e 't/test_dir') { # if we are running "t/rule_tests.t", kluge around ...
+    chdir 't';
+  }
+
+  if (-e 'test_dir') {            # running from test directory, not ..
+    unshift(@INC, '../blib/lib');
+    unshift(@INC, '../lib');
+  }
+}
+
+use strict;
+use Test;
+use Mail::SpamAssassin::Util;
+
+# each well-formed case is decoded by MIME::Base64 / MIME::QuotedPrint when
+# they're available; the others have to come out the same as they always
+# did from the Perl fallbacks
+my @base64 = (
+  # encoded, wanted bytes, decoded
+  [ "SGVsbG8gd29ybGQh\n", undef, "Hello world!" ],
+  [ "SGVsbG8g\r\nd29y\r\nbGQh\r\n", undef, "Hello world!" ],
+  [ "SGVsbG8gd29ybGQ=\n", undef, "Hello world" ],
+  [ "  \nSGVs\nbG8g\n\nd29ybGQh\n\n", 4, "Hell" ],
+  [ "SGVsbG8gd29ybGQh\n", 100, "Hello world!" ],
+  [ "SGVsbG8=\nd29ybGQh\n", undef, "Hello\0world!" ],     # inner padding
+  [ "SGVsbG8gd29ybG\n", undef, "Hello worl" ],            # truncated
+  [ "SGVs!bG8g*d29y\n", undef, "Hello wor" ],             # junk
+);
+
+my @qp = (
+  # encoded, decoded
+  [ "caf=C3=A9 na=c3=afve\n", "caf\xc3\xa9 na\xc3\xafve\n" ],
+  [ "a soft=\nbreak, and a =\r\nCRLF one\n", "a softbreak, and a CRLF one\n" ],
+  [ "a split =3=\nD escape\n", "a split = escape\n" ],
+  [ "trailing space =3D \n", "trailing space = \n" ],
+  [ "a CR =3D\r\n", "a CR =\r\n" ],
+  [ "==\n\n=3D=\n\n", "=\n=\n" ],
+  [ "=g0 and =4 are left alone=", "=g0 and =4 are left alone=" ],
+  [ "nothing to decode\n", "nothing to decode\n" ],
+);
+
+plan tests => @base64 + @qp;
+
+foreach (@base64) {
+  my ($in, $bytes, $want) = @{$_};
+  ok(Mail::SpamAssassin::Util::base64_decode($in, $bytes), $want);
+}
+
+foreach (@qp) {
+  my ($in, $want) = @{$_};
+  ok(Mail::SpamAssassin::Util::qp_decode($in), $want);
+}